@@ -12,7 +12,28 @@
 #include <thread>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <cstdlib> // Added for EXIT_FAILURE
+#include <ctime>
+#include <mutex>
+#include "reactor.h"
+#include "workpool.h"
+#include "showinventory.h"
+#include "holds.h"
+#include "wallets.h"
+#include "tokens.h"
+#include "userstore.h"
+#include "catalog.h"
+#include "catalogimport.h"
+#include "pricing.h"
+#include "authpool.h"
+#include "timerwheel.h"
+#include "seatfinder.h"
+#include "seatfeed.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "paymentsvc.h"
+#include "protocol.h"
 
 using namespace std;
 
@@ -30,6 +51,7 @@ public:
     char password[50];
 };
 
+// a catalog entry as the first log and snapshot format stored it
 class Movie
 {
 public:
@@ -40,20 +62,30 @@ public:
 };
 
 int limitadmin = 1;
-int limituser = 2;
-const int movienum = 6; // give choice to admin to add movie ...by default 3 is there but space for 6 is considered
 
 const char *mainserverIP = "127.0.0.1"; // IPv4 loopback
 const int mainserverPort = 12345;
 const int serverAdmin_client_login = 12346;
 const int serverAdmin_client_other = 12347;
 
-Movie movie[movienum];
-int hall[9][9];
-unordered_map<string, int> m;
+Catalog catalog;
+const Venue hallLayout = defaultHall();
+SeatFinder finder(hallLayout);
+Pricing pricing(hallLayout); // what a seat of each tier costs, per show
+ShowInventory shows(hallLayout.rows, hallLayout.cols); // one seat bitset per (movie, date, slot)
+SeatStore seatFile;        // the same bitsets mapped from seats.bin for other processes
+SeatFeed feed;             // who gets which show's seat changes pushed
+HoldTable holds;           // booked but not yet paid
+TokenCache tokens;         // replies to charges that may be retried
+TimerWheel holdTimers;     // expires the holds
+const int tickMs = 100;    // resolution of holdTimers
+WalletLedger wallets;      // balances; users it has not seen yet have 2000
+Wal wal;           // every sale, so a restart does not lose it
 sem_t *sem1; // admin-server
 sem_t *sem2;
 sem_t *sem3; // client_admin
+WorkPool *pool = nullptr; // runs the requests decoded by the 12347 reactor
+Reactor *reactor = nullptr;
 
 int login_signup_handle()
 {
@@ -176,85 +208,220 @@ int login_signup_handle()
     }
     return 1;
 }
-void moviedetails(int num)
+void logtitle(const Title &t);
+void logremoved(int32_t id);
+void logtitles(const vector<Title> &imported);
+void logshows(const vector<ShowKey> &added);
+bool loadpricing();
+void repriceall();
+void setwallet();
+bool checkpoint();
+string snapshotPath();
+void moviedetails()
 {
     // 3 movies by default
     // to change movie , to change movie cost and all thing will be given to admin
-    int rat[num] = {9, 8, 7, 0, 0, 0};
-    string mname[num] = {"barbie", "openhimer", "Baby", "", "", ""};
-    string lang[num] = {"English", "spanish", "hindi", "", "", ""};
-    int cst[num] = {90, 70, 50, 0, 0, 0};
+    const int num = 3;
+    int rat[num] = {9, 8, 7};
+    string mname[num] = {"barbie", "openhimer", "Baby"};
+    string lang[num] = {"English", "spanish", "hindi"};
+    int cst[num] = {90, 70, 50};
     // less than 7 rating all is Rs 30
     // 7 => 50 , // 8 =>70 // 9=>90 \\ 10=>100;
-    // dynamic pricing to be added in as future scope
-    int i = 0;
-    // sem_wait(sem2);
-    for (int j = 0; j < movienum; j++)
-    {
-        if (rat[i] > 0 && (movie[j].rating == 0 || movie[j].rating == -1))
+    // seat prices on top of these move with demand and the calendar (pricing.h)
+    // the defaults not already showing, published together
+    catalog.update([&](vector<Title> &titles)
+                   {
+        for (int i = 0; i < num; i++)
         {
-            strcpy(movie[i].name, mname[i].c_str());
-            strcpy(movie[i].lang, lang[i].c_str());
-            movie[i].rating = rat[i];
-            movie[i].cost = cst[i];
-            i++;
-        }
-    }
-
-    // sem_post(sem2);
+            if (any_of(titles.begin(), titles.end(), [&](const Title &t) { return t.name == mname[i]; }))
+                continue;
+            Title t;
+            t.id = catalog.newId();
+            t.name = mname[i];
+            t.lang = lang[i];
+            t.rating = rat[i];
+            t.cost = cst[i];
+            titles.push_back(t);
+            logtitle(t);
+        } });
 }
-void showmovie(int num)
+void showmovie()
 {
-    int i = 0;
-    // sem_wait(sem2);
-    while (i < num)
+    auto cat = catalog.read();
+    for (const Title &t : cat->titles)
     {
-        if (movie[i].rating > 0)
-        {
-            cout << "Movie : " << i + 1 << "\n";
-            cout << "Name: " << movie[i].name << "\n";
-            cout << "In:" << movie[i].lang << "\n";
-            cout << "Rating: " << movie[i].rating << "\n";
-            cout << "Price: " << movie[i].cost << "\n";
-            cout << "\n";
-        }
-        i++;
+        cout << "Movie : " << t.id << "\n";
+        cout << "Name: " << t.name << "\n";
+        cout << "In:" << t.lang << "\n";
+        cout << "Rating: " << t.rating << "\n";
+        cout << "Price: " << t.cost << "\n";
+        cout << "Screen: " << t.screen << "\n";
+        cout << "\n";
     }
-    // sem_post(sem2);
 }
-void addmovie(int num)
+void addmovie()
 {
-    int i = 0;
-    // sem_wait(sem2);
-    while (movie[i].rating > 0)
-        i++;
-    // sem_post(sem2);
-
-    if (i == 6)
-    {
-        cout << "Capacity FULL !!! Please remove older movies \n";
-        return;
-    }
+    Title t;
     cout << "Please Provide Movie Details below :\n";
     cout << "Movie Name :";
-    cin >> movie[i].name;
+    cin >> t.name;
     cout << "Language :";
-    cin >> movie[i].lang;
+    cin >> t.lang;
     cout << "Rating :";
-    cin >> movie[i].rating;
+    cin >> t.rating;
     cout << "Ticket Price";
-    cin >> movie[i].cost;
+    cin >> t.cost;
+    cout << "Screen :";
+    cin >> t.screen;
+    catalog.update([&](vector<Title> &titles)
+                   {
+        t.id = catalog.newId();
+        titles.push_back(t);
+        logtitle(t); });
+    cout << "Added as movie " << t.id << "\n";
 }
-void removemovie(int num, int whichmovie)
+void removemovie(int whichmovie)
 {
-    // lsit all the movie to admin so that he can choose the one which is to be removed
-    // "whichmovie" must be movie index which is to be removed
-    // sem_wait(sem2);
-    movie[whichmovie].rating = -1;
-    strcpy(movie[whichmovie].name, "");
-    strcpy(movie[whichmovie].lang, "");
-    movie[whichmovie].cost = 0;
-    // sem_post(sem2);
+    // "whichmovie" is the number showmovie lists the movie under
+    bool found = false;
+    catalog.update([&](vector<Title> &titles)
+                   {
+        auto it = find_if(titles.begin(), titles.end(), [&](const Title &t) { return t.id == whichmovie; });
+        if ((found = it != titles.end()))
+        {
+            titles.erase(it);
+            logremoved(whichmovie);
+        } });
+    if (!found)
+        cout << "No movie " << whichmovie << "\n";
+}
+// reads a catalog/schedule file (catalogimport.h) and publishes all of it as
+// one catalog version, or none of it if any row is wrong. A movie already in
+// the catalog under the same name is replaced and keeps its id
+bool importcatalog(const string &path)
+{
+    auto started = chrono::steady_clock::now();
+    CatalogImport file;
+    bool ok = file.load(path, max(1u, thread::hardware_concurrency()));
+    for (const string &e : file.errors)
+        cout << path << ": " << e << "\n";
+    if (ok)
+    {
+        // shows may also be of movies the catalog already has
+        auto cat = catalog.read();
+        unordered_set<string> known;
+        for (const Title &t : file.titles)
+            known.insert(t.name);
+        for (const Title &t : cat->titles)
+            known.insert(t.name);
+        for (const string &name : file.movies)
+            if (!known.count(name))
+            {
+                cout << path << ": shows of " << name << ", which is not a movie\n";
+                ok = false;
+            }
+    }
+    if (!ok)
+    {
+        cout << "Nothing imported\n";
+        return false;
+    }
+
+    vector<int32_t> idOf(file.movies.size());
+    size_t replaced = 0;
+    uint64_t version = catalog.update(
+        [&](vector<Title> &titles)
+        {
+            unordered_map<string, size_t> byName;
+            for (size_t i = 0; i < titles.size(); i++)
+                byName.emplace(titles[i].name, i);
+            for (Title &t : file.titles)
+            {
+                auto it = byName.find(t.name);
+                if (it != byName.end())
+                {
+                    t.id = titles[it->second].id;
+                    titles[it->second] = t;
+                    replaced++;
+                }
+                else
+                {
+                    t.id = catalog.newId();
+                    byName.emplace(t.name, titles.size());
+                    titles.push_back(t);
+                }
+            }
+            logtitles(file.titles);
+            for (size_t i = 0; i < file.movies.size(); i++)
+                idOf[i] = titles[byName[file.movies[i]]].id;
+        },
+        [&](const shared_ptr<const Schedule> &old)
+        {
+            vector<ShowKey> added(file.shows.size());
+            for (size_t i = 0; i < added.size(); i++)
+            {
+                const CatalogImport::Row &r = file.shows[i];
+                added[i] = ShowKey{idOf[r.movie], r.date, r.slot};
+            }
+            logshows(added);
+            return old->with(move(added));
+        });
+    long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    cout << "Imported " << file.titles.size() << " movies (" << replaced << " replaced) and " << file.shows.size()
+         << " shows from " << file.rows << " rows in " << ms << " ms, catalog version " << version << "\n";
+    return true;
+}
+// AUTH_THREADS: password hashing threads of the 12346 listener (default:
+// one per core); AUTH_QUEUE: logins that may wait for one before the rest
+// are told the server is busy
+unsigned authThreads()
+{
+    const char *env = getenv("AUTH_THREADS");
+    if (env != nullptr && atoi(env) > 0)
+        return atoi(env);
+    return max(1u, thread::hardware_concurrency());
+}
+size_t authQueue()
+{
+    const char *env = getenv("AUTH_QUEUE");
+    return env != nullptr && atoi(env) > 0 ? atoi(env) : 256;
+}
+
+// ADMIN_WORKERS overrides the pool size, default is one worker per core
+unsigned workerCount()
+{
+    const char *env = getenv("ADMIN_WORKERS");
+    if (env != nullptr && atoi(env) > 0)
+        return atoi(env);
+    return max(1u, thread::hardware_concurrency());
+}
+void showstats()
+{
+    if (pool == nullptr)
+    {
+        cout << "Booking server not running yet\n";
+        return;
+    }
+    cout << "Workers: " << pool->size() << "\n";
+    cout << "Queued requests: " << pool->queueDepth() << "\n";
+    cout << "Executed batches: " << pool->executedCount() << "\n";
+    cout << "Steals: " << pool->stealCount() << "\n";
+    cout << "Seat holds awaiting payment: " << holds.size() << "\n";
+    cout << "Wallets: " << wallets.size() << "\n";
+    {
+        auto cat = catalog.read();
+        cout << "Catalog: " << cat->titles.size() << " movies, version " << cat->number << ", "
+             << catalog.retiredCount() << " old versions still read\n";
+    }
+    cout << "Retried requests answered from the token cache: " << tokens.repeatCount() << "\n";
+    cout << "Connections subscribed to seat changes: " << feed.connectionCount() << "\n";
+    cout << "Log records: " << wal.appended() << " in " << wal.syncCount() << " syncs, " << wal.bytes() << " bytes\n";
+    auto r = pricing.rules();
+    cout << "Seat prices:";
+    for (const PriceRules::Tier &t : r->tiers)
+        cout << " " << t.name << " " << t.base;
+    cout << ", " << r->bands.size() << " demand bands, " << r->calendar.size() << " festival and season periods\n";
 }
 void all()
 {
@@ -267,28 +434,55 @@ void all()
         cout << "Enter 3 to Add a movie \n";
         cout << "Enter 4 to Remove a movie from the List \n";
         cout << "Enter 5 to Exit\n";
-        cout << "Enter your choice (1-5): ";
+        cout << "Enter 6 to Show booking server statistics\n";
+        cout << "Enter 7 to Save a snapshot now\n";
+        cout << "Enter 8 to Import movies and shows from a file\n";
+        cout << "Enter 9 to Reload the pricing rules\n";
+        cout << "Enter 10 to Set a user's wallet balance\n";
+        cout << "Enter your choice (1-10): ";
         cin >> choice;
 
         switch (choice)
         {
         case 1:
-            moviedetails(movienum);
+            moviedetails();
             break;
         case 2:
-            showmovie(movienum);
+            showmovie();
             break;
         case 3:
-            addmovie(movienum);
+            addmovie();
             break;
         case 4:
             cout << "Enter index of movie to be removed : ";
             cin >> which;
-            removemovie(movienum, which);
+            removemovie(which);
             break;
         case 5:
             cout << "Have a Nice Day !!\nDo visit again!!!!\n";
             break;
+        case 6:
+            showstats();
+            break;
+        case 7:
+            cout << (checkpoint() ? "Snapshot saved to " : "Could not save snapshot to ") << snapshotPath() << "\n";
+            break;
+        case 8:
+        {
+            string path;
+            cout << "File to import : ";
+            cin >> path;
+            if (importcatalog(path) && !checkpoint())
+                cout << "Could not save snapshot to " << snapshotPath() << "\n";
+            break;
+        }
+        case 9:
+            if (loadpricing())
+                thread(repriceall).detach();
+            break;
+        case 10:
+            setwallet();
+            break;
         default:
             cout << "Invalid choice." << endl;
             break;
@@ -296,127 +490,712 @@ void all()
     }
     cout << "I am thread with name all who handles movie display\n";
 }
-void handleClient(int clientSocket)
+const int useridLen = 50; // longest user id we accept, same as client.cpp Usrid
+const int bookLen = 10;   // seats per booking request, int book[10] in client.cpp
+
+const int slotnum = 9;    // time slots A-I offered by client.cpp
+const int showdays = 3;   // bookable days starting today
+const uint32_t maxResults = 50; // titles one OP_SEARCH returns at most
+
+int yyyymmdd(time_t t)
 {
-    char buffer[1024];
-    ssize_t bytesReceived;
+    tm day;
+    localtime_r(&t, &day);
+    return (day.tm_year + 1900) * 10000 + (day.tm_mon + 1) * 100 + day.tm_mday;
+}
 
-    while (true)
+// a show exists if the movie is in the catalog and the date is bookable:
+// on the imported schedule, or without one any slot of the next few days.
+// One day of slack on both ends for clients sitting across midnight
+bool validshow(const ShowKey &k)
+{
+    if (k.slot < 0 || k.slot >= slotnum)
+        return false;
+    time_t now = time(nullptr);
+    if (k.date < yyyymmdd(now - 24 * 60 * 60))
+        return false;
+    auto cat = catalog.read();
+    const Title *t = cat->find(k.movie);
+    if (t == nullptr || t->rating <= 0)
+        return false;
+    if (!cat->schedule->shows.empty())
+        return cat->schedule->contains(k);
+    return k.date <= yyyymmdd(now + showdays * 24 * 60 * 60);
+}
+
+ShowKey readshow(WireReader &in)
+{
+    ShowKey k;
+    k.movie = in.i32();
+    k.date = in.i32();
+    k.slot = in.i32();
+    return k;
+}
+
+// HOLD_TTL overrides how many seconds booked seats wait for the payment
+int holdTTL()
+{
+    const char *env = getenv("HOLD_TTL");
+    if (env != nullptr && atoi(env) > 0)
+        return atoi(env);
+    return 300;
+}
+
+// write-ahead log records; each carries absolute state, so replaying one
+// twice does no harm. What one request changes together (seats, wallet and
+// hold) is one record, a crash keeps all of it or none
+enum WalRecord : uint8_t
+{
+    WAL_SEATS = 1,    // show, u64 version, u8 taken, u32 n, u32 bits[n]
+    WAL_HOLD = 2,     // u64 hold, show, u32 n, u32 bits[n], str user, i32 charged
+    WAL_HOLD_END = 3, // u64 hold, u8 sold (0 = released or expired)
+    WAL_WALLET = 4,   // str user, i32 balance
+    WAL_MOVIE = 5,    // i32 index, Movie (older logs; rating <= 0 = removed)
+    WAL_TITLE = 6,    // u8 listed, title (just the id if not listed)
+    WAL_SHOWS = 7,    // u32 n, show[n] added to the schedule
+    // u64 hold, show, u64 seat version, u32 n, u32 bits[n], str user, i32 charged,
+    // u8 paid from the wallet, i32 balance after
+    WAL_BOOKED = 8,
+    // u64 hold, show, u64 seat version, u32 n, u32 bits[n], u8 refunded, str user, i32 balance after
+    WAL_RELEASED = 9,
+    WAL_PAID = 10,    // u64 hold, i32 charged, str user, i32 balance after
+    WAL_TITLES = 11,  // u32 n, title[n] added or replaced by an import
+};
+
+// highest log record the current batch of requests wrote; its replies wait
+// until that one is on disk
+thread_local uint64_t batchLsn = 0;
+
+// set while the seats of a hold are booked or released: the seat change is
+// logged with the hold (WAL_BOOKED, WAL_RELEASED) instead of on its own, and
+// its version is left here
+thread_local uint64_t *heldVersion = nullptr;
+
+void logrecord(const Wire &rec)
+{
+    batchLsn = max(batchLsn, wal.append(rec.buf));
+}
+
+Wire &putbits(Wire &w, const vector<int> &bits)
+{
+    w.u32(bits.size());
+    for (int b : bits)
+        w.u32(b);
+    return w;
+}
+
+vector<int> readbits(WireReader &in)
+{
+    vector<int> bits;
+    uint32_t n = in.u32();
+    for (uint32_t i = 0; i < n && in.ok; i++)
+        bits.push_back(in.u32());
+    return bits;
+}
+
+// the catalog entry as the admin just left it; called inside
+// catalog.update(), so the log has the edits in version order
+void logtitle(const Title &t)
+{
+    Wire rec;
+    rec.u8(WAL_TITLE).u8(1);
+    logrecord(putTitle(rec, t));
+}
+void logremoved(int32_t id)
+{
+    logrecord(Wire().u8(WAL_TITLE).u8(0).i32(id));
+}
+
+// the titles of an import, a record per 64k of them; replay applies each
+// record as one version instead of one per title
+void logtitles(const vector<Title> &imported)
+{
+    const size_t perRecord = 65536;
+    for (size_t i = 0; i < imported.size(); i += perRecord)
+    {
+        size_t n = min(perRecord, imported.size() - i);
+        Wire rec;
+        rec.u8(WAL_TITLES).u32(n);
+        for (size_t j = i; j < i + n; j++)
+            putTitle(rec, imported[j]);
+        logrecord(rec);
+    }
+}
+
+// shows joining the schedule, a record per 64k of them
+void logshows(const vector<ShowKey> &added)
+{
+    const size_t perRecord = 65536;
+    for (size_t i = 0; i < added.size(); i += perRecord)
     {
-        // Receive request type from the client
-        bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
+        size_t n = min(perRecord, added.size() - i);
+        Wire rec;
+        rec.u8(WAL_SHOWS).u32(n);
+        for (size_t j = i; j < i + n; j++)
+            rec.show(added[j]);
+        logrecord(rec);
+    }
+}
+
+// the ledger calls this with the account still locked, so the log has a
+// user's balances in order
+void logwallet(const string &user, int32_t balance)
+{
+    logrecord(Wire().u8(WAL_WALLET).str(user).i32(balance));
+}
+
+// hold id, show, seat version and seats of a WAL_BOOKED / WAL_RELEASED
+Wire &putheld(Wire &w, uint64_t id, const Hold &h, uint64_t version)
+{
+    w.u64(id).show(h.show).u64(version);
+    return putbits(w, h.bits);
+}
 
-        if (bytesReceived <= 0)
+// gives the seats of a hold back and refunds what it charged, logged as one
+// record once both are done (inside the wallet's lock, so the balance is
+// in order with the user's other records)
+void releasehold(uint64_t id, const Hold &h)
+{
+    uint64_t version = 0;
+    heldVersion = &version;
+    shows.get(h.show).release(h.bits);
+    heldVersion = nullptr;
+    auto logged = [&](bool refunded, int32_t balance)
+    {
+        Wire rec;
+        putheld(rec.u8(WAL_RELEASED), id, h, version).u8(refunded).str(h.user).i32(balance);
+        logrecord(rec);
+    };
+    uint32_t account;
+    if (h.charged > 0 && wallets.intern(h.user, account))
+        wallets.credit(account, h.charged, [&](const string &, int32_t balance)
+                       { logged(true, balance); });
+    else
+        logged(false, 0);
+}
+
+// OP_PAY: settles a hold from its user's wallet. What the booking already
+// charged counts, the rest of the price is taken now; only a paid hold is
+// sold by OP_CONFIRM, and paying it again changes nothing. The debit and the
+// hold's new charge are logged as one record inside the wallet's lock
+int32_t payhold(uint64_t id, const string &user, int32_t most, int32_t &balance)
+{
+    Hold h;
+    balance = 0;
+    if (!holds.update(id, [&](Hold &held)
+                      { h = held; }))
+        return PAY_NO_HOLD;
+    uint32_t account;
+    if (h.user.empty() || h.user != user || !wallets.intern(h.user, account))
+        return PAY_BAD_USER;
+    balance = wallets.balance(account);
+    if (h.price > most)
+        return PAY_BAD_AMOUNT;
+    int32_t owed = h.price - h.charged;
+    bool held = true, fresh = false;
+    auto settle = [&](Hold &now)
+    {
+        fresh = !now.paid;
+        now.charged = max(now.charged, now.price);
+        now.paid = true;
+    };
+    if (owed <= 0)
+        held = holds.update(id, settle);
+    else
+    {
+        int32_t before;
+        if (!wallets.debit(account, owed, before, [&](const string &, int32_t after)
+                           {
+                               held = holds.update(id, settle);
+                               if (held && fresh)
+                                   logrecord(Wire().u8(WAL_PAID).u64(id).i32(h.price).str(h.user).i32(after)); }))
+            return PAY_DECLINED;
+        // released, expired or paid meanwhile: the money goes back
+        if (!held || !fresh)
+            wallets.credit(account, owed, logwallet);
+    }
+    balance = wallets.balance(account);
+    return held ? PAY_OK : PAY_NO_HOLD;
+}
+
+// admin top-up: the only way to set a balance outright, logged like any
+// other balance change
+void setwallet()
+{
+    string user;
+    int32_t balance;
+    cout << "User id : ";
+    cin >> user;
+    cout << "New balance : ";
+    cin >> balance;
+    uint32_t account;
+    if (!cin || balance < 0 || user.size() > (size_t)useridLen || !wallets.intern(user, account))
+    {
+        cout << "Balance not changed\n";
+        return;
+    }
+    int32_t before = wallets.balance(account);
+    wallets.set(account, balance, logwallet);
+    cout << "Wallet of " << user << ": " << before << " -> " << balance << "\n";
+}
+
+// a hold on the seats bookseats() just took at 'version', charged 'spend'
+// to the account's wallet (none: nullptr) if its balance covers it; 'before'
+// is the balance found, h.charged what was taken. The hold is in the table
+// and the wallet debited before the one record with all of it is logged
+uint64_t addhold(Hold &h, uint64_t version, const uint32_t *account, int32_t spend, int32_t &before)
+{
+    uint64_t id = holds.newId();
+    auto logged = [&](bool paid, int32_t balance)
+    {
+        holds.add(id, h);
+        Wire rec;
+        putheld(rec.u8(WAL_BOOKED), id, h, version).str(h.user).i32(h.charged).u8(paid).i32(balance);
+        logrecord(rec);
+    };
+    before = 0;
+    if (account == nullptr || !wallets.debit(*account, spend, before, [&](const string &, int32_t balance)
+                                             { h.charged = spend;
+                                               logged(true, balance); }))
+        logged(false, 0);
+    holdTimers.schedule(id, (uint64_t)holdTTL() * 1000 / tickMs);
+    return id;
+}
+
+// abandoned carts: a hold nobody confirmed or released within HOLD_TTL
+void expire_holds()
+{
+    while (true)
+    {
+        this_thread::sleep_for(chrono::milliseconds(tickMs));
+        for (uint64_t id : holdTimers.tick())
         {
-            // Connection closed or error
-            break;
+            Hold h;
+            if (holds.take(id, h))
+                releasehold(id, h);
         }
-        ssize_t rec = 0;
-        buffer[bytesReceived] = '\0';
-        // Process the request type and send the corresponding item
-        int requestType = atoi(buffer);
-        const char *itemToSend = nullptr;
-        int k = 0;
-        int initial_amt = 2000;
-        string t;
-        int counter;
-        switch (requestType)
+    }
+}
+
+// reads int seat[10]: the seat bits go to 'bits' and the slot each came from
+// to 'slot'; returns the slots that name no seat of this hall (bit i = seat[i])
+unsigned readseats(const SeatMap &hall, WireReader &in, vector<int> &bits, vector<int> &slot)
+{
+    unsigned conflicts = 0;
+    for (int i = 0; i < bookLen; i++)
+    {
+        int seat = in.i32();
+        if (seat < 0)
+            continue;
+        if (!hall.valid(seat / 10, seat % 10))
         {
-        case 1:
-            send(clientSocket, &movie, sizeof(movie), 0);
-            break;
-        case 2:
-            send(clientSocket, &hall, sizeof(hall), 0);
-            break;
-        case 3:
-            int seat[10];
-            rec = recv(clientSocket, seat, 10 * sizeof(int), 0);
-            if (rec > 0)
-            {
-                for (int i = 0; i < 10; i++)
-                {
-                    if (seat[i] >= 0)
-                    {
-                        hall[seat[i] / 10][seat[i] % 10] = -1;
-                    }
-                }
-                // Now 'hall' on the server side is updated.
-            }
-            else if (rec == 0)
-            {
-                std::cerr << "Client disconnected." << std::endl;
-            }
-            else
-            {
-                perror("Error receiving data from the client");
-            }
-            break;
-        case 4:
+            conflicts |= 1u << i;
+            continue;
+        }
+        bits.push_back(hall.bit(seat / 10, seat % 10));
+        slot.push_back(i);
+    }
+    return conflicts;
+}
 
-            counter = 1;
-            send(clientSocket, &counter, sizeof(counter), 0);
+// books the seats all or nothing for a hold; returns which of the 10 slots
+// conflicted, 0 = every seat is booked at 'version' (addhold() logs them)
+unsigned bookseats(Show &show, const vector<int> &bits, const vector<int> &slot, uint64_t &version)
+{
+    unsigned conflicts = 0;
+    heldVersion = &version;
+    uint64_t lost = show.book(bits);
+    heldVersion = nullptr;
+    for (size_t k = 0; k < slot.size(); k++)
+        if ((lost >> k) & 1)
+            conflicts |= 1u << slot[k];
+    return conflicts;
+}
 
-            char name[1024];
-            rec = recv(clientSocket, name, sizeof(name), 0);
+// a seat change of one show, encoded once; every subscriber is sent the
+// same buffer
+void pushchange(const ShowKey &key, uint64_t version, const vector<int> &bits, bool taken)
+{
+    vector<Peer> to = feed.subscribers(key);
+    if (to.empty() || reactor == nullptr)
+        return;
+    Wire ev;
+    ev.show(key).u64(version).u32(bits.size());
+    for (int b : bits)
+        ev.u32(b).u8(taken);
+    auto frame = make_shared<string>();
+    putFrame(*frame, OP_SEAT_EVENT, 0, ev.buf);
+    reactor->push(move(to), move(frame));
+}
 
-            if (rec == 0)
-                std::cerr << "Client disconnected." << std::endl;
-            else if (rec < 0)
-                perror("Error receiving data from the client");
+// every seat change of every show, right after its CAS. Changes of one show
+// get here concurrently and not always in version order: records carry the
+// version (replay keeps the newest state per seat) and a subscriber that
+// sees a gap catches up with OP_SEATMAP_SINCE.
+// The show's prices follow its occupancy from here
+void seatchanged(Show &show, uint64_t version, const vector<int> &bits, bool taken)
+{
+    if (heldVersion != nullptr)
+        *heldVersion = version;
+    else
+    {
+        Wire rec;
+        rec.u8(WAL_SEATS).show(show.key).u64(version).u8(taken);
+        logrecord(putbits(rec, bits));
+    }
+    pushchange(show.key, version, bits, taken);
+    pricing.occupancy(show.price, show.key.date, show.seats);
+}
 
-            t = string(name);
-            if (m.find(t) == m.end())
-                initial_amt = 2000;
-            else
-                initial_amt = m[t];
+// the show's prices; a show nobody booked yet is priced on first use
+Quote quoteof(Show &show)
+{
+    Quote q = pricing.quote(show.price);
+    if (q.rules == 0)
+    {
+        pricing.occupancy(show.price, show.key.date, show.seats);
+        q = pricing.quote(show.price);
+    }
+    return q;
+}
 
-            send(clientSocket, &initial_amt, sizeof(initial_amt), 0);
+// movie price plus every seat at its tier's price
+int32_t priceof(const ShowKey &key, const Quote &q, const vector<int> &bits)
+{
+    int64_t price = 0;
+    {
+        auto cat = catalog.read();
+        if (const Title *t = cat->find(key.movie))
+            price = t->cost;
+    }
+    for (int b : bits)
+        price += q.price[pricing.tierOf(b)];
+    return (int32_t)min<int64_t>(price, INT32_MAX);
+}
 
-            int final_amt;
-            recv(clientSocket, &final_amt, sizeof(final_amt), 0);
+// new rules reach the shows created so far; runs on its own thread, quotes
+// keep being answered from the old prices until a show's turn comes
+void repriceall()
+{
+    auto started = chrono::steady_clock::now();
+    size_t n = 0;
+    shows.forEach([&](Show &show)
+                  {
+        pricing.reprice(show.price, show.key.date, show.seats);
+        n++; });
+    long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    cout << "Repriced " << n << " shows in " << ms << " ms\n";
+}
 
-            // cout<<"User"<<": "<<t<<"::: final amt is "<<final_amt<<"\n";
-            m[t] = final_amt;
+// PRICING_FILE: the pricing rules (default pricing.txt, built-in rules if
+// there is none)
+string pricingPath()
+{
+    const char *env = getenv("PRICING_FILE");
+    return env != nullptr ? env : "pricing.txt";
+}
+bool loadpricing()
+{
+    string error;
+    if (!pricing.load(pricingPath(), error))
+    {
+        cout << "Pricing rules not loaded: " << error << "\n";
+        return false;
+    }
+    auto r = pricing.rules();
+    cout << "Pricing rules from " << pricingPath() << ": " << r->tiers.size() << " tiers, " << r->bands.size()
+         << " demand bands, " << r->calendar.size() << " festival and season periods\n";
+    return true;
+}
 
-            break;
-        case 5:
-            int seat1[10];
-            rec = recv(clientSocket, seat1, 10 * sizeof(int), 0);
-            if (rec > 0)
-            {
+// OP_SEATMAP_SINCE reply: the changes after 'since', or the whole map
+void seatsince(Show &show, uint64_t since, Wire &reply)
+{
+    vector<SeatDelta> deltas;
+    uint64_t version;
+    if (show.changes.since(since, deltas, version))
+    {
+        reply.u8(0).u64(version).u32(deltas.size());
+        for (SeatDelta &d : deltas)
+            reply.u32(d.bit).u8(d.taken);
+        return;
+    }
+    vector<uint64_t> words(show.seats.wordCount());
+    version = show.changes.snapshot([&]()
+                                    { show.seats.snapshot(words.data()); });
+    reply.u8(1).u64(version).u16(show.seats.rowCount()).u16(show.seats.colCount());
+    for (uint64_t w : words)
+        reply.u64(w);
+}
 
-                for (int i = 0; i < 10; i++)
-                {
-                    if (seat1[i] >= 0)
-                    {
-                        hall[seat1[i] / 10][seat1[i] % 10] = 1;
-                    }
-                }
-                // Now 'hall' on the server side is updated.
-            }
-            else if (rec == 0)
-            {
-                std::cerr << "Client disconnected." << std::endl;
-            }
-            else
-            {
-                perror("Error receiving data from the client");
-            }
-            break;
+// runs on a worker; appends the reply frame for one request (sent by 'from')
+// to out
+void perform(const Frame &r, Peer from, string &out)
+{
+    WireReader in(r.payload);
+    Wire reply;
+
+    // seat requests start with the show they are about
+    Show *show = nullptr;
+    ShowKey key{};
+    if (r.opcode == OP_SEATMAP || r.opcode == OP_SEATMAP_SINCE || r.opcode == OP_SUBSCRIBE || r.opcode == OP_UNSUBSCRIBE ||
+        r.opcode == OP_BOOK || r.opcode == OP_BOOK_CHARGE || r.opcode == OP_FIND_SEATS || r.opcode == OP_QUOTE)
+    {
+        key = readshow(in);
+        if (!in.ok || !validshow(key))
+        {
+            putFrame(out, OP_ERROR, r.reqid, "Unknown Show");
+            return;
+        }
+        show = &shows.get(key);
+    }
 
-        default:
-            itemToSend = "Invalid Request";
-            k = 1;
+    switch (r.opcode)
+    {
+    case OP_LIST:
+        reply.buf = *catalog.read()->listing;
+        break;
+    case OP_SEATMAP:
+    {
+        vector<uint64_t> words(show->seats.wordCount());
+        show->seats.snapshot(words.data());
+        reply.u16(show->seats.rowCount()).u16(show->seats.colCount());
+        for (uint64_t w : words)
+            reply.u64(w);
+        break;
+    }
+    case OP_SEATMAP_SINCE:
+        // what changed since the version the client has, or everything
+        seatsince(*show, in.u64(), reply);
+        break;
+    case OP_SUBSCRIBE:
+    {
+        // subscribed before the reply is built, so no change falls in between;
+        // events the reply already contains carry versions the client ignores
+        uint64_t since = in.u64();
+        if (!in.ok)
+            break;
+        feed.subscribe(key, from);
+        seatsince(*show, since, reply);
+        break;
+    }
+    case OP_UNSUBSCRIBE:
+        reply.u32(feed.unsubscribe(key, from) ? 0 : 1);
+        break;
+    case OP_BOOK:
+    {
+        // booked seats are only held until OP_CONFIRM, OP_RELEASE or HOLD_TTL
+        vector<int> bits, slot;
+        unsigned conflicts = readseats(show->seats, in, bits, slot);
+        uint64_t hold = 0, version = 0;
+        if (conflicts == 0 && in.ok)
+            conflicts = bookseats(*show, bits, slot, version);
+        if (conflicts == 0 && in.ok)
+        {
+            // nothing is charged: it cannot be confirmed until it is paid
+            Hold h{key, bits, "", 0, priceof(key, quoteof(*show), bits)};
+            int32_t unused;
+            hold = addhold(h, version, nullptr, 0, unused);
+        }
+        reply.u32(conflicts).u64(hold);
+        break;
+    }
+    case OP_BOOK_CHARGE:
+    {
+        // book + wallet update in one round trip; nothing is charged unless
+        // every seat was booked
+        vector<int> bits, slot;
+        unsigned conflicts = readseats(show->seats, in, bits, slot);
+        int spend = in.i32();
+        string t = in.str().substr(0, useridLen);
+        int32_t initial_amt = 0, final_amt = 0;
+        uint32_t account;
+        uint64_t hold = 0, version = 0;
+        // charged at the price the show has now, unless it went up past
+        // what the client agreed to
+        int32_t price = priceof(key, quoteof(*show), bits);
+        bool agreed = price <= spend;
+        spend = price;
+        if (conflicts == 0 && in.ok && agreed)
+            conflicts = bookseats(*show, bits, slot, version);
+        if (conflicts == 0 && in.ok && agreed)
+        {
+            // only taken if the wallet covers all of it; if not the balance
+            // stays as it is, payment declines and the client releases the seats
+            Hold h{key, bits, t, 0, spend};
+            hold = addhold(h, version, wallets.intern(t, account) ? &account : nullptr, spend, initial_amt);
+            final_amt = initial_amt - h.charged;
         }
+        reply.u32(conflicts).i32(initial_amt).i32(final_amt).u64(hold).i32(price);
+        break;
+    }
+    case OP_QUOTE:
+    {
+        Quote q = quoteof(*show);
+        const Venue &v = pricing.layout();
+        reply.u32(v.tiers.size());
+        for (size_t i = 0; i < v.tiers.size(); i++)
+            reply.i32(v.tiers[i].first).i32(v.tiers[i].second).i32(q.price[i]);
+        break;
+    }
+    case OP_FIND_SEATS:
+    {
+        // only a suggestion, the client still books them like any other seats
+        int tier = in.i32();
+        int n = in.i32();
+        vector<uint64_t> words(show->seats.wordCount());
+        show->seats.snapshot(words.data());
+        vector<pair<int, int>> seats;
+        finder.find(words.data(), tier, n, seats);
+        reply.u32(seats.size());
+        for (auto &s : seats)
+            reply.i32(s.first).i32(s.second);
+        break;
+    }
+    case OP_CONFIRM:
+    {
+        // paid: the seats stay taken and nothing expires them any more. A
+        // hold whose wallet did not cover it stays a hold
+        Hold h;
+        uint64_t id = in.u64();
+        int status = holds.takeIf(id, h, [](const Hold &held)
+                                  { return held.paid && held.charged >= held.price; });
+        if (status == 0)
+            logrecord(Wire().u8(WAL_HOLD_END).u64(id).u8(1));
+        reply.u32(status);
+        break;
+    }
+    case OP_PAY:
+    {
+        uint64_t id = in.u64();
+        string t = in.str().substr(0, useridLen);
+        int32_t most = in.i32();
+        int32_t balance = 0;
+        reply.u32(in.ok ? payhold(id, t, most, balance) : PAY_BAD_AMOUNT).i32(balance);
+        break;
+    }
+    case OP_RELEASE:
+    {
+        Hold h;
+        uint64_t id = in.u64();
+        bool found = holds.take(id, h);
+        if (found)
+            releasehold(id, h);
+        // Now 'hall' on the server side is updated.
+        reply.u32(found ? 0 : 1);
+        break;
+    }
+    case OP_WALLET:
+    {
+        string t = in.str().substr(0, useridLen);
+        uint32_t account;
+        reply.i32(wallets.lookup(t, account) ? wallets.balance(account) : wallets.openingBalance());
+        break;
+    }
+    case OP_SEARCH:
+    {
+        string name = in.str(), lang = in.str();
+        int32_t minRating = in.i32();
+        uint32_t k = min(in.u32(), maxResults);
+        if (!in.ok)
+            break;
+        auto cat = catalog.read();
+        vector<uint32_t> hits = cat->index->search(name, lang, minRating, k);
+        reply.u64(cat->number).u32(hits.size());
+        for (uint32_t i : hits)
+            putTitle(reply, cat->titles[i]);
+        break;
+    }
+    default:
+        putFrame(out, OP_ERROR, r.reqid, "Invalid Request");
+        return;
+    }
+    if (!in.ok)
+    {
+        putFrame(out, OP_ERROR, r.reqid, "Truncated Request");
+        return;
+    }
+    putFrame(out, r.opcode, r.reqid, reply.buf);
+}
 
-        // Send the item to the client
-        if (k == 1)
-            send(clientSocket, itemToSend, strlen(itemToSend), 0);
+// perform() for requests that may be retried: one with an idempotency token
+// runs once, its repeats get the first reply, held back like it until the
+// records it wrote are on disk.
+// A listing is not built at all: the reply is a header in front of the
+// current catalog version's encoded listing, which is sent from where it is
+void execute(const Frame &r, Peer from, Replies &out)
+{
+    if (r.opcode == OP_LIST && r.flags == 0)
+    {
+        SharedFrame listing = catalog.read()->listing;
+        putFrameHeader(out.bytes, OP_LIST, r.reqid, listing->size());
+        out.splice(move(listing));
+        return;
+    }
+    if (!(r.flags & FLAG_TOKEN))
+        return perform(r, from, out.bytes);
+    if (r.payload.size() < 8)
+    {
+        putFrame(out.bytes, OP_ERROR, r.reqid, "Truncated Request");
+        return;
     }
+    Frame req = r;
+    req.payload.resize(r.payload.size() - 8);
+    uint64_t token = WireReader(r.payload.data() + req.payload.size(), 8).u64();
+    uint64_t lsn = 0;
+    string first = tokens.once(token, lsn, [&](uint64_t &wrote)
+                               {
+        uint64_t before = batchLsn;
+        batchLsn = 0;
+        string frame;
+        perform(req, from, frame);
+        wrote = batchLsn;
+        batchLsn = before;
+        return frame; });
+    batchLsn = max(batchLsn, lsn);
+    // the stored frame carries the request id of the first copy
+    size_t pos = 0;
+    Frame f;
+    takeFrame(first, pos, f);
+    putFrame(out.bytes, f.opcode, r.reqid, f.payload);
+}
+
+// cuts every complete frame out of c.in and ships them to the pool as one
+// batch; a connection has at most one batch in flight so its replies keep
+// their order. A frame that is only partly received stays in c.in.
+void handleClient(Connection &c)
+{
+    vector<Frame> batch;
+    size_t pos = 0;
+    Frame f;
+    FrameStatus st;
+    while ((st = takeFrame(c.in, pos, f)) == FrameStatus::Ok)
+        batch.push_back(move(f));
+    c.in.erase(0, pos);
+    if (st == FrameStatus::Bad)
+    {
+        // unknown version or absurd length, we cannot find the next frame
+        putFrame(c.out, OP_ERROR, f.reqid, "Bad Frame");
+        c.in.clear();
+        c.closing = true;
+    }
+    if (batch.empty())
+        return;
 
-    // Close the client socket
-    close(clientSocket);
+    c.busy = true;
+    int fd = c.fd;
+    uint64_t id = c.id;
+    pool->submit([batch = move(batch), fd, id]()
+                 {
+        Replies out;
+        batchLsn = 0;
+        for (const Frame &r : batch)
+            execute(r, {fd, id}, out);
+        // nothing is acknowledged before it would survive a crash
+        wal.whenDurable(batchLsn, [fd, id, out = move(out)]() mutable
+                        { reactor->complete(fd, id, move(out)); }); });
 }
+
 void act_server()
 {
 
@@ -445,7 +1224,7 @@ void act_server()
     }
 
     // Listen for incoming connections
-    if (listen(serverSocket, 5) == -1)
+    if (listen(serverSocket, SOMAXCONN) == -1)
     {
         perror("listen");
         close(serverSocket);
@@ -453,38 +1232,396 @@ void act_server()
     }
 
     cout << "Server listening on port " << serverAdmin_client_other << "..." << endl;
-    int user_cnt = 0;
-    // vector<thread> threads;
-    while (user_cnt < limituser)
+
+    // every client is multiplexed on this one thread; nobody waits in the backlog
+    // for another booking to finish. The requests themselves run on the pool.
+    pool = new WorkPool(workerCount());
+    cout << "Booking pool started with " << pool->size() << " workers" << endl;
+    Reactor server(serverSocket, handleClient);
+    server.onClose([](Connection &c)
+                   { feed.drop(c.id); });
+    string lag;
+    putFrame(lag, OP_LAGGED, 0, "");
+    server.setLagNotice(move(lag));
+    reactor = &server;
+    if (server.init())
+        server.run();
+
+    // Close the server socket (only reached if epoll fails)
+    close(serverSocket);
+
+    // return 0;
+}
+
+// WAL_WINDOW_US: how long a log record may wait for others to share its sync
+unsigned walWindow()
+{
+    const char *env = getenv("WAL_WINDOW_US");
+    if (env != nullptr && atoi(env) >= 0)
+        return atoi(env);
+    return 500;
+}
+
+// SNAPSHOT_SECS: how often the checkpointer looks for new log records
+int snapshotSecs()
+{
+    const char *env = getenv("SNAPSHOT_SECS");
+    if (env != nullptr && atoi(env) > 0)
+        return atoi(env);
+    return 60;
+}
+
+string snapshotPath()
+{
+    const char *env = getenv("SNAPSHOT_PATH");
+    return env != nullptr ? env : "admin.snap";
+}
+
+// fuzzy checkpoint, nobody is stopped while it runs: the log moves on to a
+// new segment first, then catalog, shows, holds and wallets are copied one by
+// one under the same short locks the requests take. Whatever changes during
+// the copy is in the new segment too, and replaying an absolute record over
+// state that already has it changes nothing. Older segments are deleted once
+// the snapshot is safely renamed into place
+bool checkpoint()
+{
+    uint64_t segment = wal.rotate();
+    Wire body, part;
+
     {
-        // Accept connection
-        int clientSocket = accept(serverSocket, nullptr, nullptr);
-        if (clientSocket == -1)
-        {
-            perror("accept");
-            continue;
-        }
+        auto cat = catalog.read();
+        body.u32(cat->titles.size());
+        for (const Title &t : cat->titles)
+            putTitle(body, t);
+        body.u32(cat->schedule->shows.size());
+        for (const ShowKey &k : cat->schedule->shows)
+            body.show(k);
+    }
+    body.i32(catalog.idsUsed()); // read after the titles, it is at least past theirs
+
+    uint32_t n = 0;
+    shows.forEach([&](Show &s)
+                  {
+        vector<uint64_t> words(s.seats.wordCount());
+        uint64_t version = s.changes.snapshot([&]()
+                                              { s.seats.snapshot(words.data()); });
+        part.show(s.key).u64(version).u32(words.size());
+        for (uint64_t w : words)
+            part.u64(w);
+        n++; });
+    body.u32(n).bytes(part.buf.data(), part.buf.size());
+
+    part = Wire();
+    n = 0;
+    holds.forEach([&](uint64_t id, const Hold &h)
+                  {
+        part.u64(id).show(h.show);
+        putbits(part, h.bits).str(h.user).i32(h.charged);
+        n++; });
+    body.u32(n).bytes(part.buf.data(), part.buf.size());
+
+    n = 0;
+    part = Wire();
+    wallets.forEach([&](const string &user, int32_t balance)
+                    {
+        part.str(user).i32(balance);
+        n++; });
+    body.u32(n).bytes(part.buf.data(), part.buf.size());
+
+    if (!writeSnapshot(snapshotPath(), segment, body.buf))
+        return false;
+    wal.dropBefore(segment);
+    return true;
+}
 
-        // Handle the client in a separate thread or process
-        // threads.emplace_back(handleClient, ClientSocket);
-        handleClient(clientSocket);
-        user_cnt++;
+// writes a snapshot every SNAPSHOT_SECS if anything was logged meanwhile, so
+// a restart only replays the last few seconds of log
+void checkpoints()
+{
+    uint64_t last = wal.appended();
+    while (true)
+    {
+        this_thread::sleep_for(chrono::seconds(snapshotSecs()));
+        uint64_t now = wal.appended();
+        if (now != last && checkpoint())
+            last = now;
     }
+}
 
-    // The server will never reach here in this example, as it's intended to run indefinitely
+Title movietitle(int i, const Movie &mv)
+{
+    Title t;
+    t.id = i;
+    t.name.assign(mv.name, strnlen(mv.name, sizeof(mv.name)));
+    t.lang.assign(mv.lang, strnlen(mv.lang, sizeof(mv.lang)));
+    t.rating = mv.rating;
+    t.cost = mv.cost;
+    return t;
+}
 
-    // Close the server socket (this line will not be reached in this example)
-    close(serverSocket);
+// one log record (or snapshot entry) back into the in-memory state
+void applyrecord(WireReader &in, uint8_t type, unordered_map<uint64_t, Hold> &unpaid)
+{
+    switch (type)
+    {
+    case WAL_SEATS:
+    {
+        ShowKey k = readshow(in);
+        uint64_t version = in.u64();
+        bool taken = in.u8();
+        vector<int> bits = readbits(in);
+        if (in.ok)
+            shows.get(k).restore(bits, taken, version);
+        break;
+    }
+    case WAL_HOLD:
+    {
+        uint64_t id = in.u64();
+        Hold h;
+        h.show = readshow(in);
+        h.bits = readbits(in);
+        h.user = in.str();
+        h.charged = in.i32();
+        if (in.ok)
+            unpaid[id] = move(h);
+        break;
+    }
+    case WAL_HOLD_END:
+        unpaid.erase(in.u64());
+        break;
+    case WAL_BOOKED:
+    case WAL_RELEASED:
+    {
+        uint64_t id = in.u64();
+        Hold h;
+        h.show = readshow(in);
+        uint64_t version = in.u64();
+        h.bits = readbits(in);
+        bool paid;
+        int32_t balance;
+        if (type == WAL_BOOKED)
+        {
+            h.user = in.str();
+            h.charged = in.i32();
+            paid = in.u8();
+        }
+        else
+        {
+            paid = in.u8();
+            h.user = in.str();
+        }
+        balance = in.i32();
+        if (!in.ok)
+            break;
+        shows.get(h.show).restore(h.bits, type == WAL_BOOKED, version);
+        uint32_t account;
+        if (paid && wallets.intern(h.user, account))
+            wallets.set(account, balance);
+        if (type == WAL_BOOKED)
+            unpaid[id] = move(h);
+        else
+            unpaid.erase(id);
+        break;
+    }
+    case WAL_PAID:
+    {
+        uint64_t id = in.u64();
+        int32_t charged = in.i32();
+        string user = in.str();
+        int32_t balance = in.i32();
+        uint32_t account;
+        if (!in.ok)
+            break;
+        auto it = unpaid.find(id);
+        if (it != unpaid.end())
+            it->second.charged = charged;
+        if (wallets.intern(user, account))
+            wallets.set(account, balance);
+        break;
+    }
+    case WAL_WALLET:
+    {
+        string user = in.str();
+        int balance = in.i32();
+        uint32_t account;
+        if (in.ok && wallets.intern(user, account))
+            wallets.set(account, balance);
+        break;
+    }
+    case WAL_MOVIE:
+    {
+        int i = in.i32();
+        Movie mv;
+        in.bytes(&mv, sizeof(mv));
+        if (!in.ok || i < 0)
+            break;
+        if (mv.rating <= 0)
+            catalog.remove(i);
+        else
+            catalog.put(movietitle(i, mv));
+        break;
+    }
+    case WAL_TITLE:
+    {
+        if (in.u8())
+        {
+            Title t = readTitle(in);
+            if (in.ok)
+                catalog.put(t);
+        }
+        else
+        {
+            int32_t id = in.i32();
+            if (in.ok)
+                catalog.remove(id);
+        }
+        break;
+    }
+    case WAL_TITLES:
+    {
+        uint32_t n = in.u32();
+        if (!in.ok || n > in.left() / 20)
+            break;
+        vector<Title> imported(n);
+        for (Title &t : imported)
+            t = readTitle(in);
+        if (in.ok)
+            catalog.put(imported);
+        break;
+    }
+    case WAL_SHOWS:
+    {
+        uint32_t n = in.u32();
+        if (!in.ok || n > in.left() / 12)
+            break;
+        vector<ShowKey> added(n);
+        for (ShowKey &k : added)
+            k = readshow(in);
+        if (in.ok)
+            catalog.update([](vector<Title> &) {},
+                           [&](const shared_ptr<const Schedule> &old)
+                           { return old->with(move(added)); });
+        break;
+    }
+    }
+}
 
-    // return 0;
+// the snapshot's state; false if it does not parse. Format 1 snapshots
+// have the catalog as Movie[], formats before 3 no schedule, before 4 no
+// next title id (the shows and holds then tell which ids were in use)
+bool loadsnapshot(const string &body, uint32_t format, unordered_map<uint64_t, Hold> &unpaid)
+{
+    WireReader in(body);
+    uint32_t n = in.u32();
+    vector<Title> listed;
+    for (uint32_t i = 0; i < n && in.ok; i++)
+    {
+        if (format >= 2)
+        {
+            listed.push_back(readTitle(in));
+            continue;
+        }
+        Movie mv;
+        in.bytes(&mv, sizeof(mv));
+        if (mv.rating > 0)
+            listed.push_back(movietitle(i, mv));
+    }
+    auto schedule = make_shared<Schedule>();
+    if (format >= 3)
+    {
+        schedule->shows.resize(in.u32());
+        for (ShowKey &k : schedule->shows)
+            k = readshow(in);
+    }
+    int32_t nextId = format >= 4 ? in.i32() : 0;
+    if (in.ok)
+        catalog.update([&](vector<Title> &titles)
+                       { titles = listed; },
+                       [&](const shared_ptr<const Schedule> &)
+                       { return schedule; });
+    n = in.u32();
+    for (uint32_t i = 0; i < n && in.ok; i++)
+    {
+        ShowKey k = readshow(in);
+        nextId = max(nextId, k.movie + 1);
+        uint64_t version = in.u64();
+        vector<uint64_t> words(in.u32());
+        for (uint64_t &w : words)
+            w = in.u64();
+        Show &s = shows.get(k);
+        if (in.ok && words.size() == s.seats.wordCount())
+            s.restore(words.data(), version);
+    }
+    n = in.u32();
+    for (uint32_t i = 0; i < n && in.ok; i++)
+        applyrecord(in, WAL_HOLD, unpaid);
+    for (auto &it : unpaid)
+        nextId = max(nextId, it.second.show.movie + 1);
+    catalog.skipIds(nextId);
+    n = in.u32();
+    for (uint32_t i = 0; i < n && in.ok; i++)
+        applyrecord(in, WAL_WALLET, unpaid);
+    return in.ok;
 }
 
-int main()
+// opens the seat file (SEAT_FILE, default seats.bin, room for
+// SEAT_FILE_SHOWS shows), loads the latest snapshot (SNAPSHOT_PATH, default
+// admin.snap) and replays the log segments written after it (WAL_PATH,
+// default admin.wal.<n>), so seats, holds, wallets and the catalog are where
+// the last run left them.
+// Holds that were still waiting for a payment are released and refunded: the
+// client that made them has lost its connection
+void recover()
 {
+    auto started = chrono::steady_clock::now();
+    const char *seats = getenv("SEAT_FILE");
+    const char *room = getenv("SEAT_FILE_SHOWS");
+    uint32_t capacity = room != nullptr && atoi(room) > 0 ? atoi(room) : 65536;
+    if (seatFile.create(seats != nullptr ? seats : "seats.bin", hallLayout.rows, hallLayout.cols, capacity))
+        shows.attach(&seatFile);
+    else
+        cout << "No seat file, seat maps are only visible through the server\n";
+    const char *env = getenv("WAL_PATH");
+    string path = env != nullptr ? env : "admin.wal";
+    unordered_map<uint64_t, Hold> unpaid;
+    uint64_t from = 1;
+    string body;
+    uint32_t format = 0;
+    bool snap = readSnapshot(snapshotPath(), from, body, &format);
+    if (snap && !loadsnapshot(body, format, unpaid))
+        cout << "Snapshot " << snapshotPath() << " is damaged, replaying what is left of the log\n";
+    size_t n = 0;
+    if (wal.open(path))
+        n = wal.replay(from, [&](const string &rec)
+                       {
+            WireReader in(rec);
+            uint8_t type = in.u8();
+            applyrecord(in, type, unpaid); });
+    else
+        cout << "Running without a write-ahead log, sales will not survive a restart\n";
+    shows.forEach([](Show &s)
+                  { s.recovered(); });
+    shows.onChange(seatchanged);
+    wal.start(walWindow());
+    for (auto &it : unpaid)
+        releasehold(it.first, it.second);
+    long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    cout << "Recovered " << (snap ? "snapshot + " : "") << n << " log records in " << ms << " ms, released "
+         << unpaid.size() << " unpaid holds\n";
+}
+
+int main(int argc, char **argv)
+{
+    // admin --import <file>: load a catalog/schedule file into the log and
+    // snapshot while the booking server is down, without starting it
+    if (argc == 3 && strcmp(argv[1], "--import") == 0)
+    {
+        recover();
+        bool ok = importcatalog(argv[2]) && checkpoint();
+        cout.flush();
+        _exit(ok ? 0 : 1); // the log's flusher thread is still running
+    }
 
-    for (int i = 0; i < 9; i++)
-        for (int j = 0; j < 9; j++)
-            hall[i][j] = 1;
     // key_t key1 = ftok("/tmp", 'A');//admin-server(creater)
     // int shmid1 = shmget(key1, sizeof(AdminData) *limitadmin, 0666);
     // AdminData* Admin_data = (AdminData*)shmat(shmid1, NULL, 0);
@@ -519,7 +1656,7 @@ int main()
     if (p == 0)
     {
         // this child process to handle acting as a server for client
-        int user_cnt = 0;
+        // signups and logins
         cout << "Admin Server started." << endl;
         // Create socket for IPv4
         int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
@@ -553,52 +1690,74 @@ int main()
             _exit(1);
         }
 
-        std::cout << "Server listening on port 12346..." << std::endl;
-        int admin_cnt = 0;
-
-        while (user_cnt < limituser)
+        // USER_FILE (default users.bin, index in users.bin.idx)
+        const char *file = getenv("USER_FILE");
+        UserStore users;
+        if (!users.open(file != nullptr ? file : "users.bin"))
         {
-
-            // sem_wait(sem3);
-            // while(strlen(user_data[user_cnt].username) !=0){
-            //     cout <<"\n-------------------"<<getpid()<<" : User " << user_data[user_cnt].username << " logged in------------------------" << endl;
-            //     user_cnt = (user_cnt + 1);
-            //     }
-            // sem_post(sem3);
-            // sleep(2);
-
-            int clientSocket = accept(serverSocket, nullptr, nullptr);
-            if (clientSocket == -1)
+            close(serverSocket);
+            _exit(1);
+        }
+        std::cout << "Server listening on port 12346... (" << users.size() << " registered users)" << std::endl;
+
+        // password hashes are computed on the auth pool, never on this loop, so
+        // a crowd logging in at once does not hold up the connections behind it
+        AuthPool auth(authThreads(), authQueue());
+        std::vector<uint32_t> scratch;
+        const PasswordHash decoy = hashPassword("", 14, 8, 1, scratch); // unknown users cost a hash too
+        scratch = std::vector<uint32_t>();
+        Reactor *loop = nullptr;
+        auto answer = [&](Peer to, int32_t status)
+        {
+            AccountReply reply{};
+            reply.status = status;
+            strcpy(reply.message, accountText[status]);
+            loop->complete(to.fd, to.id, string((const char *)&reply, sizeof(reply)));
+        };
+        Reactor accounts(serverSocket, [&](Connection &c)
+                         {
+            if (c.in.size() < sizeof(AccountRequest))
+                return;
+            AccountRequest req;
+            memcpy(&req, c.in.data(), sizeof(req));
+            c.in.clear();
+            req.username[accountNameLen - 1] = req.password[accountNameLen - 1] = '\0';
+            // one request per connection, closed once the answer is out
+            c.busy = true;
+            c.closing = true;
+            Peer from{c.fd, c.id};
+            string user = req.username;
+            bool queued;
+            if (req.op == ACCOUNT_SIGNUP)
             {
-                perror("accept");
-                continue;
+                if (user.empty() || users.exists(user.c_str()))
+                {
+                    answer(from, user.empty() ? ACCOUNT_INVALID : ACCOUNT_EXISTS);
+                    return;
+                }
+                queued = auth.hash(req.password, [&, from, user](bool, const PasswordHash &h)
+                                   {
+                    // the store has one writer, this loop
+                    loop->post([&, from, user, h]()
+                               {
+                        AccountStatus st = users.add(user.c_str(), h);
+                        if (st == ACCOUNT_OK)
+                            std::cout << "New Client :: Username: " << user << " ==> Signed up " << std::endl;
+                        answer(from, st); }); });
             }
-
-            UserData userdata;
-            ssize_t bytesReceived = recv(clientSocket, &userdata, sizeof(userdata), 0);
-
-            if (bytesReceived <= 0)
+            else
             {
-                // Connection closed or error
-                close(clientSocket);
-                continue; // Exit inner loop and wait for the next client
+                PasswordHash h;
+                bool known = users.secret(user.c_str(), h);
+                queued = auth.verify(req.password, known ? h : decoy, [&, from, known](bool ok, const PasswordHash &)
+                                     { answer(from, ok && known ? ACCOUNT_OK : ACCOUNT_INVALID); });
             }
-
-            // Process administrator's data (
-            std::cout << "Received Client Data:" << std::endl;
-            std::cout << "New Client :: "
-                         "Username: "
-                      << userdata.username << " ==> Signed in " << std::endl;
-            // std::cout << "Password: " << adminData.password << std::endl;
-
-            // Send a response back to the client
-            const char *responseMessage = "Data received by the server!";
-            send(clientSocket, responseMessage, strlen(responseMessage), 0);
-
-            user_cnt = (user_cnt + 1);
-        }
-
-        cout << "AdminServer cannot take more than " << limituser << " Clients\n";
+            memset(req.password, 0, sizeof(req.password));
+            if (!queued)
+                answer(from, ACCOUNT_BUSY); });
+        loop = &accounts;
+        if (accounts.init())
+            accounts.run();
 
         close(serverSocket);
         // shmdt(user_data);
@@ -608,12 +1767,21 @@ int main()
     {
         // this is main admin process
         cout << "Admin started." << endl;
+        if (access(pricingPath().c_str(), F_OK) == 0)
+            loadpricing();
+        else
+            cout << "No " << pricingPath() << ", built-in pricing rules\n";
+        recover();
         login_signup_handle();
         // below calls must be in switch case ...interactive
         thread t1(all);
         thread t2(act_server);
+        thread t3(expire_holds);
+        thread t4(checkpoints);
         t1.join();
         t2.join();
+        t3.join();
+        t4.join();
 
         //  moviedetails(movie, movienum);
         //  showmovie(movie, movienum);
@@ -0,0 +1,113 @@
+// authpool.h
+#pragma once
+// password hashing off the network threads: a few CPU threads take hash and
+// verify jobs from one bounded queue. A full queue refuses new jobs instead of
+// letting a login storm pile up, so the caller can answer "busy" right away.
+// Results are handed to the job's callback on the pool thread; callers that
+// must finish on their own loop pass them on (Reactor::post)
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "kdf.h"
+
+class AuthPool
+{
+public:
+    // ok: the password matched (verify) or was hashed (hash); h: the new hash
+    using Done = std::function<void(bool ok, const PasswordHash &h)>;
+
+    // 'capacity' jobs may wait; every thread keeps 128 * r * 2^logN bytes of
+    // scratch memory
+    AuthPool(unsigned threads, size_t capacity, int logN = 14, int r = 8, int p = 1)
+        : capacity(capacity), logN(logN), r(r), p(p)
+    {
+        if (threads == 0)
+            threads = 1;
+        for (unsigned i = 0; i < threads; i++)
+            workers.emplace_back(&AuthPool::loop, this);
+    }
+    ~AuthPool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+    AuthPool(const AuthPool &) = delete;
+    AuthPool &operator=(const AuthPool &) = delete;
+
+    // hashes a new password with a fresh salt; false if the queue is full
+    bool hash(std::string password, Done done) { return submit({false, std::move(password), {}, std::move(done)}); }
+
+    // checks password against h; false if the queue is full
+    bool verify(std::string password, const PasswordHash &h, Done done)
+    {
+        return submit({true, std::move(password), h, std::move(done)});
+    }
+
+    size_t size() const { return workers.size(); }
+    size_t queueDepth()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return jobs.size();
+    }
+
+private:
+    struct Job
+    {
+        bool verify;
+        std::string password;
+        PasswordHash h;
+        Done done;
+    };
+
+    const size_t capacity;
+    const int logN, r, p;
+    std::mutex m;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    bool submit(Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            if (jobs.size() >= capacity)
+                return false;
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    void loop()
+    {
+        std::vector<uint32_t> scratch;
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lk(m);
+                wake.wait(lk, [this]() { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            if (job.verify)
+                job.done(checkPassword(job.password, job.h, scratch), job.h);
+            else
+                job.done(true, hashPassword(job.password, logN, r, p, scratch));
+            // the password does not outlive the job
+            std::fill(job.password.begin(), job.password.end(), '\0');
+        }
+    }
+};
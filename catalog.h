@@ -0,0 +1,301 @@
+// catalog.h
+#pragma once
+// the movies on offer and, once one is imported, the schedule of their
+// shows. The catalog is a chain of immutable versions: readers
+// pin the current one and never take a lock, an admin edit copies it, changes
+// the copy and publishes it with one pointer swap. A request therefore sees
+// the whole catalog before an edit or the whole catalog after it, never half.
+// Replaced versions are freed by epoch: a reader announces the epoch it
+// entered in, and a version retired in epoch g is deleted once no reader from
+// epoch g or earlier is left
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "protocol.h"
+#include "titleindex.h"
+
+// one movie; 'id' is what ShowKey::movie refers to and is never reused
+struct Title
+{
+    int32_t id = -1;
+    std::string name;
+    std::string lang;
+    int32_t rating = 0;
+    int32_t cost = 0;   // ticket price
+    int32_t screen = 1; // where it plays
+};
+
+// i32 id, str name, str lang, i32 rating, i32 cost, i32 screen
+inline Wire &putTitle(Wire &w, const Title &t)
+{
+    return w.i32(t.id).str(t.name).str(t.lang).i32(t.rating).i32(t.cost).i32(t.screen);
+}
+
+inline Title readTitle(WireReader &in)
+{
+    Title t;
+    t.id = in.i32();
+    t.name = in.str();
+    t.lang = in.str();
+    t.rating = in.i32();
+    t.cost = in.i32();
+    t.screen = in.i32();
+    return t;
+}
+
+inline bool showBefore(const ShowKey &a, const ShowKey &b)
+{
+    if (a.movie != b.movie)
+        return a.movie < b.movie;
+    return a.date != b.date ? a.date < b.date : a.slot < b.slot;
+}
+
+// the shows that are on, sorted by showBefore without duplicates
+struct Schedule
+{
+    std::vector<ShowKey> shows;
+
+    bool contains(const ShowKey &k) const { return std::binary_search(shows.begin(), shows.end(), k, showBefore); }
+
+    // this schedule plus 'more'
+    std::shared_ptr<const Schedule> with(std::vector<ShowKey> more) const
+    {
+        std::sort(more.begin(), more.end(), showBefore);
+        auto s = std::make_shared<Schedule>();
+        s->shows.reserve(shows.size() + more.size());
+        std::merge(shows.begin(), shows.end(), more.begin(), more.end(), std::back_inserter(s->shows), showBefore);
+        s->shows.erase(std::unique(s->shows.begin(), s->shows.end()), s->shows.end());
+        return s;
+    }
+};
+
+class Catalog
+{
+    struct Slot;
+
+public:
+    struct Version
+    {
+        uint64_t number = 0;
+        std::vector<Title> titles; // by id
+        // the OP_LIST payload, encoded once when the version is published;
+        // replies share it and may outlive the version
+        std::shared_ptr<const std::string> listing;
+        std::shared_ptr<const TitleIndex> index; // positions in 'titles'
+        // empty: no schedule was imported, any slot of the bookable days is on
+        std::shared_ptr<const Schedule> schedule;
+
+        const Title *find(int32_t id) const
+        {
+            auto it = std::lower_bound(titles.begin(), titles.end(), id,
+                                       [](const Title &t, int32_t id) { return t.id < id; });
+            return it != titles.end() && it->id == id ? &*it : nullptr;
+        }
+    };
+
+    // keeps one version alive while it is in scope; cheap enough to take per
+    // request, but do not hold one across a blocking call, it keeps every
+    // newer edit's garbage around
+    class Reader
+    {
+    public:
+        explicit Reader(const Catalog &c) : slot(c.enter()), v(c.current.load()) {}
+        ~Reader() { slot->epoch.store(0, std::memory_order_release); }
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        const Version &operator*() const { return *v; }
+        const Version *operator->() const { return v; }
+
+    private:
+        Slot *slot;
+        const Version *v;
+    };
+
+    Catalog()
+    {
+        Version *v = new Version;
+        v->schedule = std::make_shared<const Schedule>();
+        seal(*v);
+        current.store(v);
+    }
+    ~Catalog()
+    {
+        delete current.load();
+        for (auto &r : retired)
+            delete r.second;
+    }
+    Catalog(const Catalog &) = delete;
+    Catalog &operator=(const Catalog &) = delete;
+
+    // edit(titles) changes a copy of the current titles, which is then
+    // published as the next version; edits run one at a time, so anything
+    // edit() logs is logged in version order. Returns the new version number
+    template <typename F>
+    uint64_t update(F edit)
+    {
+        return update(edit, [](const std::shared_ptr<const Schedule> &s) { return s; });
+    }
+
+    // the same, but the version also gets reschedule(current schedule) as
+    // its schedule, published in the same swap as the titles
+    template <typename F, typename G>
+    uint64_t update(F edit, G reschedule)
+    {
+        std::lock_guard<std::mutex> lk(writer);
+        const Version *old = current.load();
+        Version *next = new Version(*old);
+        next->number = old->number + 1;
+        edit(next->titles);
+        std::sort(next->titles.begin(), next->titles.end(), [](const Title &a, const Title &b) { return a.id < b.id; });
+        for (const Title &t : next->titles)
+            nextId = std::max(nextId, t.id + 1);
+        next->schedule = reschedule(old->schedule);
+        seal(*next);
+        current.store(next);
+        retired.emplace_back(epoch.fetch_add(1), old);
+        reclaim();
+        return next->number;
+    }
+
+    // a fresh id for a title about to be added; only valid inside update()
+    int32_t newId() { return nextId++; }
+
+    // the id the next new title gets; no id below it is handed out again,
+    // even after its title is removed, so a snapshot has to keep it
+    int32_t idsUsed()
+    {
+        std::lock_guard<std::mutex> lk(writer);
+        return nextId;
+    }
+    // recovery: ids below 'next' were handed out before
+    void skipIds(int32_t next)
+    {
+        std::lock_guard<std::mutex> lk(writer);
+        nextId = std::max(nextId, next);
+    }
+
+    // adds or replaces t by its id (log replay)
+    void put(const Title &t) { put(std::vector<Title>{t}); }
+
+    // the same for a whole import, as one version
+    void put(const std::vector<Title> &batch)
+    {
+        update([&](std::vector<Title> &titles) {
+            std::unordered_map<int32_t, size_t> at;
+            for (size_t i = 0; i < titles.size(); i++)
+                at.emplace(titles[i].id, i);
+            for (const Title &t : batch)
+            {
+                auto it = at.find(t.id);
+                if (it != at.end())
+                    titles[it->second] = t;
+                else
+                {
+                    at.emplace(t.id, titles.size());
+                    titles.push_back(t);
+                }
+            }
+        });
+    }
+
+    // false if there was no such title
+    bool remove(int32_t id)
+    {
+        bool found = false;
+        update([&](std::vector<Title> &titles) {
+            nextId = std::max(nextId, id + 1); // log replay: it was handed out
+            auto it = std::find_if(titles.begin(), titles.end(), [&](const Title &o) { return o.id == id; });
+            if ((found = it != titles.end()))
+                titles.erase(it);
+        });
+        return found;
+    }
+
+    Reader read() const { return Reader(*this); }
+
+    // replaced versions still pinned by a reader
+    size_t retiredCount()
+    {
+        std::lock_guard<std::mutex> lk(writer);
+        reclaim();
+        return retired.size();
+    }
+
+private:
+    static const size_t slotCount = 128; // readers inside the catalog at once
+
+    struct alignas(64) Slot // own cache line, readers do not share one
+    {
+        std::atomic<uint64_t> epoch{0}; // 0 = free
+    };
+
+    std::atomic<const Version *> current;
+    mutable Slot slots[slotCount];
+    std::atomic<uint64_t> epoch{1};
+    std::mutex writer;
+    std::vector<std::pair<uint64_t, const Version *>> retired; // epoch it was replaced in
+    int32_t nextId = 0;
+
+    // what a version keeps besides its titles: the listing (u64 version,
+    // u32 n, title[n]) and the search index
+    static void seal(Version &v)
+    {
+        Wire w;
+        w.u64(v.number).u32(v.titles.size());
+        std::vector<std::string> names, langs;
+        std::vector<int32_t> ratings;
+        for (const Title &t : v.titles)
+        {
+            putTitle(w, t);
+            names.push_back(t.name);
+            langs.push_back(t.lang);
+            ratings.push_back(t.rating);
+        }
+        v.listing = std::make_shared<const std::string>(std::move(w.buf));
+        v.index = std::make_shared<const TitleIndex>(names, langs, ratings);
+    }
+
+    // claims a free slot with the current epoch, starting at this thread's
+    // own, so threads rarely meet in one. The claim is ordered before the
+    // version is loaded: a writer that swaps after it sees the claim
+    Slot *enter() const
+    {
+        static std::atomic<size_t> threads{0};
+        static thread_local size_t home = threads.fetch_add(1);
+        uint64_t e = epoch.load();
+        for (size_t i = 0;; i++)
+        {
+            Slot &s = slots[(home + i) % slotCount];
+            uint64_t free = 0;
+            if (s.epoch.load(std::memory_order_relaxed) == 0 && s.epoch.compare_exchange_strong(free, e))
+                return &s;
+        }
+    }
+
+    // deletes the versions no reader can still hold
+    void reclaim()
+    {
+        uint64_t oldest = UINT64_MAX;
+        for (const Slot &s : slots)
+        {
+            uint64_t e = s.epoch.load();
+            if (e != 0)
+                oldest = std::min(oldest, e);
+        }
+        auto keep = std::remove_if(retired.begin(), retired.end(), [&](const std::pair<uint64_t, const Version *> &r) {
+            if (r.first >= oldest)
+                return false;
+            delete r.second;
+            return true;
+        });
+        retired.erase(keep, retired.end());
+    }
+};
@@ -0,0 +1,398 @@
+// catalogimport.h
+#pragma once
+// bulk catalog and schedule files for the admin. A file is either CSV, one
+// row per line ('#' comments and blank lines are skipped):
+//     movie,<name>,<lang>,<rating 1-10>,<price>,<screen>
+//     show,<movie name>,<yyyymmdd>,<slot A-I>
+// or binary: "CIMP", u32 format 1, u32 n, title[n] (catalog.h, ids are
+// ignored), u32 m, (i32 title, i32 yyyymmdd, i32 slot 0-8)[m], where title
+// is an index into the file's own titles.
+// CSV is read in chunks cut at line ends, and several threads parse and check
+// the chunks while the next ones are read; binary show rows have a fixed size
+// and are split among the threads. Nothing is applied here: the caller gets
+// every row or the errors, and publishes the file as a whole
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "catalog.h"
+
+class CatalogImport
+{
+public:
+    struct Row // one show
+    {
+        uint32_t movie; // index into movies
+        int32_t date;   // yyyymmdd
+        int32_t slot;   // 0-8
+    };
+
+    std::vector<Title> titles;       // the file's movies in file order, without ids
+    std::vector<std::string> movies; // the names the shows refer to
+    std::vector<Row> shows;
+    std::vector<std::string> errors; // the first maxErrors problems, "line n: ..."
+    uint64_t rows = 0;               // lines (CSV) or records (binary) read
+
+    static const size_t maxErrors = 20;
+    static const size_t chunkBytes = 4 << 20;
+
+    // false if the file cannot be read or any row is wrong; 'errors' says why
+    bool load(const std::string &path, unsigned threads)
+    {
+        threads = std::max(1u, threads);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            errors.push_back(path + ": " + strerror(errno));
+            return false;
+        }
+        std::string head;
+        bool ok = readSome(fd, head, 4);
+        if (ok && head == "CIMP")
+            ok = loadBinary(fd, threads);
+        else if (ok)
+            ok = loadCsv(fd, head, threads);
+        close(fd);
+        return ok && errors.empty();
+    }
+
+    // the reasons t cannot be published, or empty
+    static std::string checkTitle(const Title &t)
+    {
+        if (t.name.empty() || t.name.size() > 200)
+            return "movie name must be 1-200 characters";
+        if (t.lang.empty() || t.lang.size() > 50)
+            return "language must be 1-50 characters";
+        if (t.rating < 1 || t.rating > TitleIndex::maxRating)
+            return "rating must be 1-10";
+        if (t.cost < 0 || t.cost > 1000000)
+            return "price must be 0-1000000";
+        if (t.screen < 1)
+            return "screen must be 1 or more";
+        return "";
+    }
+
+    static bool validDate(int32_t d)
+    {
+        int y = d / 10000, m = d / 100 % 100, day = d % 100;
+        static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        if (y < 1900 || y > 9999 || m < 1 || m > 12 || day < 1)
+            return false;
+        bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+        return day <= days[m - 1] + (m == 2 && leap);
+    }
+
+private:
+    // what one CSV chunk held; names are interned per chunk and renumbered
+    // when the chunks are put together
+    struct Part
+    {
+        std::string text;
+        uint64_t lines = 0;
+        std::vector<Title> titles;
+        std::vector<uint64_t> titleLines;
+        std::vector<std::string> names;
+        std::unordered_map<std::string, uint32_t> nameIds;
+        std::vector<Row> shows;
+        std::vector<std::pair<uint64_t, std::string>> errors; // line within the chunk
+    };
+
+    // appends up to n bytes; false on a read error
+    bool readSome(int fd, std::string &out, size_t n)
+    {
+        size_t start = out.size();
+        out.resize(start + n);
+        size_t got = 0;
+        while (got < n)
+        {
+            ssize_t r = read(fd, &out[start + got], n - got);
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r == -1)
+            {
+                errors.push_back(std::string("read: ") + strerror(errno));
+                out.resize(start + got);
+                return false;
+            }
+            if (r == 0)
+                break;
+            got += r;
+        }
+        out.resize(start + got);
+        return true;
+    }
+
+    bool loadCsv(int fd, std::string carry, unsigned threads)
+    {
+        std::deque<Part> parts; // stable addresses while more are added
+        std::deque<Part *> todo;
+        std::mutex m;
+        std::condition_variable ready, room;
+        bool eof = false;
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; i++)
+            workers.emplace_back([&]() {
+                while (true)
+                {
+                    Part *p;
+                    {
+                        std::unique_lock<std::mutex> lk(m);
+                        ready.wait(lk, [&]() { return eof || !todo.empty(); });
+                        if (todo.empty())
+                            return;
+                        p = todo.front();
+                        todo.pop_front();
+                    }
+                    room.notify_one();
+                    parse(*p);
+                }
+            });
+
+        // at most two chunks per thread wait, the file is not read into
+        // memory faster than it is parsed
+        bool ok = true;
+        while (true)
+        {
+            size_t before = carry.size();
+            if (!(ok = readSome(fd, carry, chunkBytes)))
+                break;
+            bool last = carry.size() - before < chunkBytes;
+            size_t nl = carry.rfind('\n');
+            if (!last && nl == std::string::npos)
+                continue; // one very long line, it has to end somewhere
+            size_t cut = last ? carry.size() : nl + 1;
+            std::unique_lock<std::mutex> lk(m);
+            room.wait(lk, [&]() { return todo.size() < 2 * threads; });
+            parts.emplace_back();
+            parts.back().text = carry.substr(0, cut);
+            todo.push_back(&parts.back());
+            lk.unlock();
+            ready.notify_one();
+            carry.erase(0, cut);
+            if (last)
+                break;
+        }
+        {
+            std::lock_guard<std::mutex> lk(m);
+            eof = true;
+        }
+        ready.notify_all();
+        for (auto &t : workers)
+            t.join();
+        if (!ok)
+            return false;
+
+        std::unordered_map<std::string, uint32_t> ids;    // movie name -> index into movies
+        std::unordered_map<std::string, uint64_t> listed; // movie name -> line it was listed on
+        uint64_t base = 0;
+        for (Part &p : parts)
+        {
+            for (auto &e : p.errors)
+                error(base + e.first, e.second);
+            for (size_t i = 0; i < p.titles.size(); i++)
+            {
+                auto seen = listed.emplace(p.titles[i].name, base + p.titleLines[i]);
+                if (!seen.second)
+                    error(base + p.titleLines[i], "movie " + p.titles[i].name + " is already listed on line " +
+                                                      std::to_string(seen.first->second));
+                titles.push_back(std::move(p.titles[i]));
+            }
+            std::vector<uint32_t> global(p.names.size());
+            for (size_t i = 0; i < p.names.size(); i++)
+            {
+                auto it = ids.emplace(p.names[i], movies.size());
+                if (it.second)
+                    movies.push_back(p.names[i]);
+                global[i] = it.first->second;
+            }
+            for (Row r : p.shows)
+            {
+                r.movie = global[r.movie];
+                shows.push_back(r);
+            }
+            base += p.lines;
+            p = Part();
+        }
+        rows = base;
+        return true;
+    }
+
+    static std::string_view trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    static bool number(std::string_view s, int32_t &v)
+    {
+        auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+        return !s.empty() && r.ec == std::errc() && r.ptr == s.data() + s.size();
+    }
+
+    static bool slotOf(std::string_view s, int32_t &slot)
+    {
+        if (s.size() != 1)
+            return false;
+        char c = s[0];
+        if (c >= 'a' && c <= 'i')
+            c -= 'a' - 'A';
+        slot = c >= 'A' && c <= 'I' ? c - 'A' : c >= '0' && c <= '8' ? c - '0' : -1;
+        return slot >= 0;
+    }
+
+    static void parse(Part &p)
+    {
+        std::string_view text(p.text);
+        std::string_view f[8];
+        while (!text.empty())
+        {
+            size_t end = text.find('\n');
+            std::string_view line = trim(text.substr(0, end));
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            uint64_t at = ++p.lines;
+            if (line.empty() || line[0] == '#')
+                continue;
+            size_t n = 0;
+            while (n < 8)
+            {
+                size_t comma = line.find(',');
+                f[n++] = trim(line.substr(0, comma));
+                if (comma == std::string_view::npos)
+                    break;
+                line.remove_prefix(comma + 1);
+            }
+            if (f[0] == "movie" && n == 6)
+            {
+                Title t;
+                t.name = std::string(f[1]);
+                t.lang = std::string(f[2]);
+                std::string why;
+                if (!number(f[3], t.rating) || !number(f[4], t.cost) || !number(f[5], t.screen))
+                    why = "rating, price and screen must be numbers";
+                else
+                    why = checkTitle(t);
+                if (!why.empty())
+                {
+                    p.errors.emplace_back(at, why);
+                    continue;
+                }
+                p.titles.push_back(std::move(t));
+                p.titleLines.push_back(at);
+            }
+            else if (f[0] == "show" && n == 4)
+            {
+                Row r;
+                if (f[1].empty())
+                    p.errors.emplace_back(at, "show without a movie");
+                else if (!number(f[2], r.date) || !validDate(r.date))
+                    p.errors.emplace_back(at, "date must be yyyymmdd");
+                else if (!slotOf(f[3], r.slot))
+                    p.errors.emplace_back(at, "slot must be A-I");
+                else
+                {
+                    auto it = p.nameIds.emplace(std::string(f[1]), p.names.size());
+                    if (it.second)
+                        p.names.push_back(it.first->first);
+                    r.movie = it.first->second;
+                    p.shows.push_back(r);
+                }
+            }
+            else
+                p.errors.emplace_back(at, "expected movie,name,lang,rating,price,screen or show,movie,yyyymmdd,slot");
+        }
+        p.text = std::string(); // parsed, the chunk is not needed any more
+    }
+
+    bool loadBinary(int fd, unsigned threads)
+    {
+        std::string file;
+        while (true)
+        {
+            size_t before = file.size();
+            if (!readSome(fd, file, chunkBytes))
+                return false;
+            if (file.size() - before < chunkBytes)
+                break;
+        }
+        WireReader in(file);
+        uint32_t format = in.u32(), n = in.u32();
+        if (!in.ok || format != 1)
+        {
+            errors.push_back("not a format 1 import file");
+            return false;
+        }
+        for (uint32_t i = 0; i < n && in.ok; i++)
+        {
+            Title t = readTitle(in);
+            std::string why = in.ok ? checkTitle(t) : "";
+            if (!why.empty())
+                error(i + 1, why);
+            movies.push_back(t.name);
+            titles.push_back(std::move(t));
+        }
+        uint32_t m = in.u32();
+        size_t at = file.size() - in.left();
+        if (!in.ok || (uint64_t)m * 12 != file.size() - at)
+        {
+            errors.push_back("file is cut short or has trailing bytes");
+            return false;
+        }
+        std::unordered_map<std::string, uint32_t> once;
+        for (uint32_t i = 0; i < n; i++)
+            if (!once.emplace(titles[i].name, i).second)
+                error(i + 1, "movie " + titles[i].name + " is listed twice");
+
+        // record numbers count the titles first, then the shows
+        shows.resize(m);
+        std::vector<std::vector<std::pair<uint64_t, std::string>>> found(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++)
+            workers.emplace_back([&, t]() {
+                for (uint64_t i = (uint64_t)m * t / threads; i < (uint64_t)m * (t + 1) / threads; i++)
+                {
+                    WireReader row(file.data() + at + i * 12, 12);
+                    int32_t movie = row.i32();
+                    Row &r = shows[i];
+                    r.movie = movie;
+                    r.date = row.i32();
+                    r.slot = row.i32();
+                    if (movie < 0 || (uint32_t)movie >= n)
+                        found[t].emplace_back(n + i + 1, "no such movie in the file");
+                    else if (!validDate(r.date))
+                        found[t].emplace_back(n + i + 1, "date must be yyyymmdd");
+                    else if (r.slot < 0 || r.slot > 8)
+                        found[t].emplace_back(n + i + 1, "slot must be 0-8");
+                }
+            });
+        for (auto &w : workers)
+            w.join();
+        for (auto &list : found)
+            for (auto &e : list)
+                error(e.first, e.second);
+        rows = (uint64_t)n + m;
+        return true;
+    }
+
+    void error(uint64_t line, const std::string &why)
+    {
+        if (errors.size() < maxErrors)
+            errors.push_back("line " + std::to_string(line) + ": " + why);
+        else if (errors.size() == maxErrors)
+            errors.push_back("...");
+    }
+};
@@ -0,0 +1,150 @@
+// changelog.h
+#pragma once
+// version counter of one show plus the last few hundred seat changes, so a
+// client that already has version V only downloads what changed since then.
+// Nothing here takes a lock: the CAS on the seat words runs first, then the
+// change takes its version with a fetch_add and its entries a slice of the
+// ring. A change that gives seats back takes its version before the CAS
+// instead, so whoever books those seats next (only possible once they are
+// free) always gets a later version: per seat, versions follow the order the
+// CASes happened in. Every entry carries the seat's new state rather than a
+// toggle, so changes of different seats may come out in any order
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+struct SeatDelta
+{
+    uint64_t version;
+    uint32_t bit;
+    bool taken;
+};
+
+class ChangeLog
+{
+public:
+    explicit ChangeLog(size_t capacity = 256) : ring(capacity) {}
+
+    // runs change() (the CAS; when 'taken' is false it gives seats back and
+    // must not fail); if it returns true the bits get one new version for the
+    // whole group and after(version) runs. Changes of one show may run
+    // after() concurrently and out of version order
+    template <typename C, typename F>
+    void record(const std::vector<int> &bits, bool taken, C change, F after)
+    {
+        if (bits.empty())
+            return;
+        state.fetch_add(1, std::memory_order_acq_rel);
+        uint64_t v = 0;
+        if (!taken)
+            v = next.fetch_add(1, std::memory_order_acq_rel) + 1;
+        if (!change())
+        {
+            leave();
+            return;
+        }
+        if (taken)
+            v = next.fetch_add(1, std::memory_order_acq_rel) + 1;
+        size_t at = head.fetch_add(bits.size(), std::memory_order_relaxed);
+        for (size_t i = 0; i < bits.size(); i++)
+        {
+            Entry &e = ring[(at + i) % ring.size()];
+            e.version.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            e.seat.store((uint32_t)bits[i] | (uint64_t)taken << 32 | (uint64_t)bits.size() << 33, std::memory_order_relaxed);
+            e.version.store(v, std::memory_order_release);
+        }
+        // versions become visible in order; the ones before v are already past
+        // their CAS and only writing a few entries
+        while (published.load(std::memory_order_acquire) != v - 1)
+            std::this_thread::yield();
+        published.store(v, std::memory_order_release);
+        leave();
+        after(v);
+    }
+
+    // recovery: the seats are already at version v, which the log cannot
+    // break down into changes
+    void restore(uint64_t v)
+    {
+        if (v > next.load(std::memory_order_relaxed))
+        {
+            next.store(v, std::memory_order_relaxed);
+            published.store(v, std::memory_order_release);
+            floor.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    // changes after 'since' into out; false if they are no longer all in the
+    // log (or 'since' is not a version we handed out), then send a snapshot
+    bool since(uint64_t since, std::vector<SeatDelta> &out, uint64_t &current)
+    {
+        current = published.load(std::memory_order_acquire);
+        out.clear();
+        if (since == 0 || since > current || since < floor.load(std::memory_order_relaxed) ||
+            current - since > ring.size())
+            return false;
+        // every version in (since, current] has to be there with all its
+        // entries; the ring is small, so it is simply read whole
+        std::vector<uint32_t> found(current - since, 0), wanted(current - since, 0);
+        for (Entry &e : ring)
+        {
+            uint64_t v = e.version.load(std::memory_order_acquire);
+            uint64_t seat = e.seat.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (v <= since || v > current || e.version.load(std::memory_order_relaxed) != v)
+                continue;
+            found[v - since - 1]++;
+            wanted[v - since - 1] = (uint32_t)(seat >> 33);
+            out.push_back({v, (uint32_t)seat, ((seat >> 32) & 1) != 0});
+        }
+        if (found != wanted || std::find(wanted.begin(), wanted.end(), 0u) != wanted.end())
+        {
+            out.clear();
+            return false;
+        }
+        std::stable_sort(out.begin(), out.end(), [](const SeatDelta &a, const SeatDelta &b)
+                         { return a.version < b.version; });
+        return true;
+    }
+
+    // runs f() (e.g. copying the seat words) at a moment no change is half
+    // done, retrying until it got one, and returns the version the copy is at
+    template <typename F>
+    uint64_t snapshot(F f)
+    {
+        while (true)
+        {
+            uint64_t s = state.load(std::memory_order_acquire);
+            if ((uint32_t)s != 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            uint64_t v = published.load(std::memory_order_acquire);
+            f();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (state.load(std::memory_order_relaxed) == s)
+                return v;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::atomic<uint64_t> version{0}; // 0 while the entry is rewritten
+        std::atomic<uint64_t> seat{0};    // bit, taken << 32, entries of the version << 33
+    };
+
+    std::vector<Entry> ring;
+    std::atomic<size_t> head{0};         // entries ever written
+    std::atomic<uint64_t> next{0};       // last version handed out
+    std::atomic<uint64_t> published{0};  // every version up to here is in the ring
+    std::atomic<uint64_t> floor{0};      // oldest version the entries start from
+    // changes in progress in the low 32 bits, changes finished above them
+    std::atomic<uint64_t> state{0};
+
+    void leave() { state.fetch_add((1ULL << 32) - 1, std::memory_order_acq_rel); }
+};
@@ -12,15 +12,22 @@
 #include<thread>
 #include<semaphore.h>
 #include "seatmatrix.h"
+#include "seatbitset.h"
+#include "protocol.h"
+#include "paymentsvc.h"
+#include "paymentring.h"
+#include "userstore.h"
+#include "catalog.h"
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
 
 using namespace std;
-int limituser=2;
 
 // string Usrid;//global (will be updated in logn_signup function )
 char Usrid[50];
+PaymentService payments;
+PaymentRing paymentRing; // attached when a payment service runs on this host
 string which_platform="M";//m=>movie
 
 sem_t* sem1 = sem_open("usr_signup", 0, 0666, 1);//client_admin
@@ -45,342 +52,486 @@ class UserData{
     char password[50];
 };
 
-class Movie{
-    public:
-    char name[10];
-    char lang[10];
-    int rating;
-    int cost;
-};
-
-const int movienum=6;//give choice to admin to add movie ...by default 3 is there but space for 6 is considered
-int hall[9][9];
-Movie movie[movienum];
+// our copy of the show's seats, hallRows x hallCols as the server sent them:
+// 1 free, -1 taken (or picked by us). Seat numbers are row*10+column
+vector<int> hall;
+int hallRows=0,hallCols=0;
+int &seatat(int r,int c){ return hall[r*hallCols+c]; }
+bool seatexists(int seat){ return seat>=0&&seat/10<hallRows&&seat%10<hallCols; }
+vector<Title> movies; // what the last search found
+const uint32_t moviesShown=10; // rows a search downloads
+
+// one signup or login at the admin's user registry (port 12346);
+// ACCOUNT_FAILED if it cannot be reached
+int account(AccountOp op,const char *username,const char *password,char *message){
+    int clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(serverAdmin_client_login); // Use the same port as the server
+    if (inet_pton(AF_INET, AdminserverIP, &serverAddr.sin_addr) != 1 ||
+        connect(clientSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        perror("Connect error");
+        close(clientSocket);
+        strcpy(message,"Server is Overloaded , Try after sometime !!!");
+        return ACCOUNT_FAILED;
+    }
+    AccountRequest req={};
+    req.op=op;
+    strncpy(req.username,username,accountNameLen-1);
+    strncpy(req.password,password,accountNameLen-1);
+    send(clientSocket, &req, sizeof(req), MSG_NOSIGNAL);
+
+    AccountReply reply={};
+    size_t got=0;
+    ssize_t r;
+    while(got<sizeof(reply)&&(r=recv(clientSocket,(char*)&reply+got,sizeof(reply)-got,0))>0)
+        got+=r;
+    close(clientSocket);
+    if(got<sizeof(reply)){
+        strcpy(message,"Server is Overloaded , Try after sometime !!!");
+        return ACCOUNT_FAILED;
+    }
+    reply.message[sizeof(reply.message)-1]='\0';
+    strcpy(message,reply.message);
+    return reply.status;
+}
 
+// 1 once logged in (or signed up), 0 if not
 int  login_signup_user(){
 
     int option;
     cout << "1. Login\n2. Signup" << endl;
     cin >> option;
     cout<<option<<"\n";
+    char username[50];
+    char password[50];
+    char message[60];
     if (option == 1) {
-        char username[50];
-        char password[50];
         cout << "username: ";
         cin >> username;
         cout << "Password: ";
         cin >> password;
+        if (account(ACCOUNT_LOGIN,username,password,message) != ACCOUNT_OK) {
+            cout << message << endl;
+            return 0;
+        }
         strcpy(Usrid,username);
-        bool loggedIn = false;
-
-        // for (int i = 0; i < limituser; i++) {
-        //     if (strcmp(username, user_data[i].username) == 0 && strcmp(password, user_data[i].password) == 0) {
-        //         cout << "Login success." << endl;
-        //         loggedIn = true;
-        //         break;
-        //     }
-        // }
-
-        // if (!loggedIn) {
-        //     cout << "Invalid credentials.UserId or Passward is incorrect." << endl;
-        //     return 0;
-        //    }
-        } 
+        cout << "Login success." << endl;
+        return 1;
+    }
     else if (option == 2) {
-        // Changed socket to IPv4
-        int clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-
-        // Connect to server using the public IPv4 address
-        struct sockaddr_in serverAddr;
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(serverAdmin_client_login); // Use the same port as the server
-
-        if (inet_pton(AF_INET, AdminserverIP, &serverAddr.sin_addr) != 1) {
-            std::cerr << "Invalid IPv4 address." << std::endl;
-            return EXIT_FAILURE;
-        }
-
-        if (connect(clientSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
-            perror("Connect error");
-            return EXIT_FAILURE;
-        }
-        
-        char newusername[50];
-        char newPassword[50];
-        
-        bool usernameExists = false;
-
         cout << "Enter a new username: ";
-       
-        cin >> newusername;
-        strcpy(Usrid,newusername);
-        // // Check if the username already exists
-        // sem_wait(sem1);
-        // for (int i = 0; i <limituser; i++) {
-        //     if (strcmp(newusername, user_data[i].username) == 0) {
-        //         usernameExists = true;
-        //         break;
-        //     }
-        // }
-        // sem_post(sem1);
-
-        int r=1;
-        if (usernameExists) {
-            cout << "This username already exists. Try a different one." << endl;
-            r=0;
-        } 
-        else {
-            cout << "Enter a new password: ";
-            cin >> newPassword;
-        
-            // sem_wait(sem1);
-            // for (int i = 0; i <limituser; i++) {
-            //     if (strlen(user_data[i].username) == 0) {
-            //         strcpy(user_data[i].username, newusername);
-            //         strcpy(user_data[i].password, newPassword);
-            //         cout << "User Signup successful." << endl;
-            //         r=1;
-            //         break;
-            //     }
-            // }
-            // sem_post(sem1);
-
-            UserData userdata;
-            strcpy(userdata.username,newusername);
-            strcpy(userdata.password,newPassword);
-            send(clientSocket, &userdata, sizeof(userdata), 0);
-
-            // Receive data from the server
-            char buffer[1024] = {0};
-            ssize_t bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
-
-            if (bytesReceived <= 0) {
-                // Connection closed or error
-                close(clientSocket);
-                // break; // Exit the loop and terminate the client
-                return 0;
-            }
-
-            std::cout << "Message from server: " << buffer << std::endl;
-
-            // Sleep for a while to simulate some processing
-            //  usleep(1000000); // Sleep for 1 second (adjust as needed)
-            close(clientSocket);
-            }
-            if(r==0)
-            cout<<"Server is Overloaded , Try after sometime !!!";
-        
-            return r;
+        cin >> username;
+        cout << "Enter a new password: ";
+        cin >> password;
+        int r = account(ACCOUNT_SIGNUP,username,password,message);
+        std::cout << "Message from server: " << message << std::endl;
+        if (r != ACCOUNT_OK)
+            return 0;
+        strcpy(Usrid,username);
+        cout << "User Signup successful." << endl;
+        return 1;
     }
-    return 1;
+    return 0;
 }
-void list_all_Movies(int num,int clientSocket){
-
-    const char* requestType = "1"; // Change this to test different request types
-    send(clientSocket, requestType, strlen(requestType), 0);
+// asks the server for the best rated movies matching name, lang ("" = any)
+// and minimum rating; only those few rows are downloaded
+uint32_t search_Movies(FrameConn &server,const string &name,const string &lang,int rating){
+    return server.queue(OP_SEARCH,Wire().str(name).str(lang).i32(rating).u32(moviesShown).buf);
+}
+// reqid: an OP_SEARCH request already queued on server
+void list_all_Movies(FrameConn &server,uint32_t reqid){
 
     // Receive and print the item from the server
-    // char buffer[1024];
-    // Movie movie[movienum];
-    ssize_t bytesReceived = recv(clientSocket,&movie, sizeof(movie), 0);
-
-    if (bytesReceived > 0) {
-        // buffer[bytesReceived] = '\0';
+    Frame reply;
+    movies.clear();
+    if (server.wait(reqid, reply) && reply.opcode == OP_SEARCH) {
+        WireReader in(reply.payload);
+        in.u64();
+        uint32_t n=in.u32();
+        for(uint32_t i=0;i<n&&in.ok;i++)
+            movies.push_back(readTitle(in));
+        if(!in.ok)movies.clear();
         cout << "Received Item: " << endl;
     } else {
         cerr << "Error receiving item from the server." << endl;
     }
 
-    int i=0;
-    while(movie[i].rating!=0){
+    for(size_t i=0;i<movies.size();i++){
       cout<<"\t\t\tMovie "<<i+1<<":\n";
-      cout<<"Name: "<<movie[i].name<<"\n";
-      cout<<"In:"<<movie[i].lang<<"\n";
-      cout<<"Rating: "<<movie[i].rating<<"\n";
-      cout<<"Price: "<<movie[i].cost<<"\n";
-      i++;
+      cout<<"Name: "<<movies[i].name<<"\n";
+      cout<<"In:"<<movies[i].lang<<"\n";
+      cout<<"Rating: "<<movies[i].rating<<"\n";
+      cout<<"Price: "<<movies[i].cost<<"\n";
       cout<<"\n";
     }
 }
-void showseat(int clientSocket){
-
-    const char* requestType = "2"; // Change this to test different request types
-    send(clientSocket, requestType, strlen(requestType), 0);
-
-    // Receive and print the item from the server
-    // char buffer[1024];
-        // int hall[9][9];
-
-
-    char rechall[sizeof(hall)];
-    ssize_t updatedhall = recv(clientSocket, rechall, sizeof(rechall), 0);
-    if (updatedhall > 0) {
-        std::memcpy(hall, rechall, sizeof(hall));
-        // Now 'hall' on the server side is updated.
-    } else {
-        std::cerr << "Error receiving data from the client." << std::endl;
+// show 'hall' holds and the server's version of it, so a refresh only
+// downloads the seats that changed since
+ShowKey hallShow={-1,0,0};
+uint64_t hallVersion=0;
+
+// queues a request for what changed in the show since our copy; with
+// OP_SUBSCRIBE the server also pushes every later change of the show to us
+uint32_t askseats(FrameConn &server,const ShowKey &show,uint8_t op=OP_SEATMAP_SINCE){
+    if(!(show==hallShow))
+        hallVersion=0;
+    return server.queue(op,Wire().show(show).u64(hallVersion).buf);
+}
+// brings 'hall' up to date with the reply to askseats()
+bool readseats(FrameConn &server,uint32_t reqid,const ShowKey &show,uint8_t op=OP_SEATMAP_SINCE){
+    Frame reply;
+    if(!server.wait(reqid,reply)||reply.opcode!=op)
+        return false;
+    WireReader in(reply.payload);
+    int kind=in.u8();
+    uint64_t version=in.u64();
+    if(kind==0){
+        // only what changed: seat bit and whether it is taken now
+        size_t n=in.u32();
+        for(size_t i=0;i<n&&in.ok;i++){
+            unsigned bit=in.u32();
+            int taken=in.u8();
+            if(in.ok&&bit<hall.size())
+                hall[bit]=taken?-1:1;
+        }
     }
-
-    if(which_platform=="M"){
-        cout<<"--------------Screen-------------------\n\n";
-
-        cout<<"-------------PREMIUM------------------\n";
-        for(int i=0;i<9;i++){
-            for(int j=0;j<9;j++)
-            {
-                if(hall[i][j]==1){
-                cout<<i<<j<<" ";
-                }
-                else{
-                    cout<<" * ";
-                }
-                if(j==1||j==6)cout<<"   ";
-            }
-            cout<<"\n";
-            if(i==2||i==6){
-                if(i==2)
-                cout<<"-------------BUSINESS------------------";
-                else
-                cout<<"-------------ECONOMY-------------------";
-                cout<<"\n";
+    else{
+        // the whole seat bitset, bit row*cols+col set = booked
+        int rows=in.u16(),cols=in.u16();
+        vector<uint64_t> rechall(SeatMap::wordsFor(rows,cols));
+        for(uint64_t &w:rechall)
+            w=in.u64();
+        if(!in.ok||rows<1||cols<1||cols>10)
+            return false;
+        hallRows=rows;
+        hallCols=cols;
+        hall.assign(rows*cols,1);
+        for(int i=0;i<rows;i++)
+            for(int j=0;j<cols;j++)
+                if(seatTaken(rechall.data(),cols,i,j))
+                    seatat(i,j)=-1;
+    }
+    if(!in.ok)
+        return false;
+    hallShow=show;
+    hallVersion=version;
+    return true;
+}
+bool refreshseats(FrameConn &server,const ShowKey &show,uint8_t op=OP_SEATMAP_SINCE){
+    uint32_t reqid=askseats(server,show,op);
+    return server.flush()&&readseats(server,reqid,show,op);
+}
+// the seat price of every tier of the show the last quote gave
+struct TierPrice{
+    int first,last,price; // rows first..last
+};
+vector<TierPrice> quote;
+uint32_t askquote(FrameConn &server,const ShowKey &show){
+    return server.queue(OP_QUOTE,Wire().show(show).buf);
+}
+bool readquote(FrameConn &server,uint32_t reqid){
+    Frame reply;
+    quote.clear();
+    if(!server.wait(reqid,reply)||reply.opcode!=OP_QUOTE)
+        return false;
+    WireReader in(reply.payload);
+    uint32_t n=in.u32();
+    for(uint32_t t=0;t<n&&in.ok;t++){
+        TierPrice p;
+        p.first=in.i32();
+        p.last=in.i32();
+        p.price=in.i32();
+        quote.push_back(p);
+    }
+    if(!in.ok)
+        quote.clear();
+    return in.ok;
+}
+// applies the seat changes the server pushed since we last looked; a gap in
+// the versions (or a lag notice) means we missed some, then we catch up
+void liveseats(FrameConn &server){
+    if(!server.poll())
+        return;
+    Frame f;
+    bool behind=false;
+    while(server.nextPush(f)){
+        if(f.opcode==OP_LAGGED){
+            behind=true;
+            continue;
+        }
+        WireReader in(f.payload);
+        ShowKey k{in.i32(),in.i32(),in.i32()};
+        uint64_t version=in.u64();
+        if(f.opcode!=OP_SEAT_EVENT||!in.ok||!(k==hallShow)||version<=hallVersion)
+            continue;
+        if(version!=hallVersion+1){
+            behind=true;
+            continue;
+        }
+        size_t n=in.u32();
+        for(size_t i=0;i<n;i++){
+            unsigned bit=in.u32();
+            int taken=in.u8();
+            if(in.ok&&bit<hall.size()){
+                if(taken&&hall[bit]==1)
+                    cout<<"(Seat "<<bit/hallCols<<bit%hallCols<<" was just booked by someone else)\n";
+                hall[bit]=taken?-1:1;
             }
+        }
+        hallVersion=version;
     }
-    cout<<"\n";
+    if(behind)
+        refreshseats(server,hallShow);
+}
+// the admin server's seat file when it runs on this host (SEAT_FILE, default
+// seats.bin, the same variable the admin server reads)
+const char *seatfile(){
+    const char *env=getenv("SEAT_FILE");
+    return env!=nullptr?env:"seats.bin";
+}
+void showseat(FrameConn &server,const ShowKey &show){
+
+    // the seats and their prices are independent: both go out in one flush
+    uint32_t seatsReq=askseats(server,show,OP_SUBSCRIBE);
+    uint32_t quoteReq=askquote(server,show);
+    bool ok=server.flush();
+    ok=readseats(server,seatsReq,show,OP_SUBSCRIBE)&&ok;
+    ok=readquote(server,quoteReq)&&ok;
+    if (!ok)
+        std::cerr << "Error receiving data from the server." << std::endl;
+
+    if(which_platform=="M"){
+        // straight from the mapped seat file if it is there and not behind
+        // what the server just told us, else from our copy
+        if(!moviehall(seatfile(),show,hallVersion))
+            drawhall(halllayout(hallRows,hallCols),[](int r,int c){ return seatat(r,c)==-1; });
     }
     // else if(which_platform=="S")
     // stadium();
 }
-int selectseat(int clientSocket,string &which_seats,vector<int>&seat){
-
-    int cost_per_seat=50;// to be changed further // dynamic // G/S/T seats ...diff cost 
-    int ts=seat.size();
-
-    for(int i=0;i<ts;i++){
-       cout<<"Seat "<<i+1<<" : ";
-       cin>>seat[i];
-        if(hall[seat[i]/10][seat[i]%10]==-1){
-            cout<<"Seat :"<<seat[i]<<" is already booked !!! Choose other seats!!!\n";
-            i--;
-            seat[i]=-1;
+// asks for seat number i until the user gives one that is free in our copy of hall
+void pickseat(int i,vector<int>&seat){
+    while(true){
+        cout<<"Seat "<<i+1<<" : ";
+        cin>>seat[i];
+        int r=seat[i]/10,c=seat[i]%10;
+        if(!seatexists(seat[i])){
+            cout<<"Seat :"<<seat[i]<<" does not exist !!! Choose other seats!!!\n";
             continue;
         }
-        else{
-            hall[seat[i]/10][seat[i]%10]=-1;
+        if(seatat(r,c)==-1){
+            cout<<"Seat :"<<seat[i]<<" is already booked !!! Choose other seats!!!\n";
+            continue;
         }
-        which_seats=which_seats+" "+to_string(seat[i]);
+        seatat(r,c)=-1;
+        return;
     }
-
-    const char* requestType = "3"; // Change this to test different request types
-    send(clientSocket, requestType, strlen(requestType), 0);
-    int book[10];
-
-    for(int i=0;i<10;i++)
-    if(i<seat.size())
-    book[i]=seat[i];
-    else
-    book[i]=-1;
-
-    send(clientSocket, &book,sizeof(book), 0);
-    
-    return ts*cost_per_seat;
-    
 }
-void update_transaction(int clientSocket,int spend,Person *person){
-    
-   const char* requestType = "4"; // Change this to test different request types
-   send(clientSocket, requestType, strlen(requestType), 0);
+// asks the server for seat.size() adjacent seats in one tier; false if there are none
+bool bestseats(FrameConn &server,const ShowKey &show,vector<int>&seat){
+    cout<<"1. PREMIUM\t2. BUSINESS\t3. ECONOMY\nTier : ";
+    int tier;cin>>tier;
+
+    // a fresh quote rides along, the prices may have moved while the user chose
+    uint32_t findReq=server.queue(OP_FIND_SEATS,Wire().show(show).i32(tier-1).i32(seat.size()).buf);
+    uint32_t quoteReq=askquote(server,show);
+    Frame reply;
+    bool found=server.flush()&&server.wait(findReq,reply)&&reply.opcode==OP_FIND_SEATS;
+    readquote(server,quoteReq);
+    if(!found)
+        return false;
+    WireReader in(reply.payload);
+    size_t n=in.u32();
+    if(n!=seat.size()){
+        cout<<"No "<<seat.size()<<" seats together left there, choose them yourself\n";
+        return false;
+    }
+    cout<<"Your seats :";
+    for(size_t i=0;i<n;i++){
+        int r=in.i32(),c=in.i32();
+        if(!in.ok||r<0||c<0||c>9||!seatexists(r*10+c))
+            return false;
+        seat[i]=r*10+c;
+        seatat(r,c)=-1;
+        cout<<" "<<seat[i];
+    }
+    cout<<"\n";
+    return true;
+}
+// what the seats cost at the last quote: movie price + each seat at its
+// tier's price, which the server moves with demand, festivals and seasons;
+// -1 if there is no quote
+int quoteseats(const vector<int>&seat,int movie_cost){
+    if(quote.empty())
+        return -1;
+    int total=movie_cost;
+    cout<<"Movie : "<<movie_cost<<"\n";
+    for(const TierPrice &p:quote){
+        int here=0;
+        for(int s:seat)
+            if(s/10>=p.first&&s/10<=p.last)
+                here++;
+        if(here>0)
+            cout<<here<<" seat(s) in rows "<<p.first<<"-"<<p.last<<" at "<<p.price<<"\n";
+        total+=here*p.price;
+    }
+    return total;
+}
+// books the seats and charges the wallet in one round trip (book-and-charge);
+// returns what the booking costs (movie price + seats), 0 if nothing was booked.
+// The seats are only held for us (id in 'hold') until we confirm or release them
+int selectseat(FrameConn &server,const ShowKey &show,string &which_seats,vector<int>&seat,int movie_cost,Person *person,uint64_t &hold){
 
-   int counter=0;
-   recv(clientSocket,&counter,sizeof(counter),0);
+    int ts=seat.size();
+    if(ts==0)
+        return 0;
+
+    cout<<"\nPress B for the best available seats or M to choose them yourself : ";
+    char how;cin>>how;
+    bool picked=false;
+    if(how=='B'||how=='b')
+        picked=bestseats(server,show,seat);
+    if(!picked)
+        for(int i=0;i<ts;i++){
+            liveseats(server);
+            pickseat(i,seat);
+        }
 
-   if(counter==1)
-   ssize_t bytesSent= send(clientSocket,Usrid, sizeof(Usrid), 0);
+    int spend=quoteseats(seat,movie_cost);
+    if(spend<0){
+        cerr << "Error receiving data from the server." << endl;
+        return 0;
+    }
+    cout<<"Price of the booking : "<<spend<<"\n";
+    int initial_amt=0;
+
+    // the server books the whole group or nothing and tells us which seats
+    // somebody else got first; only those have to be chosen again
+    unsigned conflicts=0;
+    do{
+        Wire req;
+        req.show(show);
+        for(int i=0;i<10;i++)
+        if(i<ts)
+        req.i32(seat[i]);
+        else
+        req.i32(-1);
+        req.i32(spend).str(Usrid);
+
+        Frame reply;
+        hold=0;
+        if(!server.callOnce(OP_BOOK_CHARGE,req.buf,reply)){
+            cerr << "Error receiving data from the server." << endl;
+            return 0;
+        }
+        WireReader in(reply.payload);
+        conflicts=in.u32();
+        initial_amt=in.i32();
+        in.i32();
+        hold=in.u64();
+        int price=in.i32();
+        if(conflicts==0&&hold==0&&in.ok&&price>spend){
+            // the show filled up a price band since the quote
+            cout<<"The price just went up to "<<price<<". Press Y to book at that price : ";
+            char yes;cin>>yes;
+            if(yes!='Y'&&yes!='y')
+                return 0;
+            spend=price;
+            conflicts=~0u;
+            continue;
+        }
+        if(hold!=0&&in.ok)
+            spend=price; // what was charged, seats picked again may be in another tier
+        if(conflicts!=0){
+            // see what else changed meanwhile, keeping the seats we still want
+            refreshseats(server,show);
+            for(int i=0;i<ts;i++)
+                if(!((conflicts>>i)&1))
+                    seatat(seat[i]/10,seat[i]%10)=-1;
+        }
+        for(int i=0;i<ts;i++){
+            if((conflicts>>i)&1){
+                cout<<"Seat :"<<seat[i]<<" was just booked by someone else !!! Choose another seat!!!\n";
+                pickseat(i,seat);
+            }
+        }
+    }while(conflicts!=0);
+    if(hold==0){
+        cerr << "The seats could not be booked, please try again." << endl;
+        return 0;
+    }
 
-    int initial_amt;
-    
-    ssize_t rec=recv(clientSocket,&initial_amt,sizeof(initial_amt),0);
-  
+    for(int i=0;i<ts;i++)
+        which_seats=which_seats+" "+to_string(seat[i]);
 
-    int final_amt=initial_amt-spend;
-   
-     
-    // write intial_amt and spend in shared memory 
-    // cout<<"Here\n";
+    // write intial_amt and spend in shared memory for the payment terminal
     strcpy(person[0].id,Usrid);
-    // strncpy(person[0].id, Usrid, sizeof(person[0].id) - 1);
-    // person[0].id[sizeof(person[0].id) - 1] = '\0';  // Ensure null-termination
     person[0].curr_bal=initial_amt;
     person[0].total_spend=spend;
-
-    // cout<<person[0].id<<"\n";
-
-
-    if(final_amt<0)
-    final_amt=0;
-
-    // recv(clientSocket,&counter,sizeof(counter),0);
-    // if(counter==2)
-
-    send(clientSocket,&final_amt,sizeof(final_amt), 0);
-   
-   
+    return spend;
+    
 }
-int payment(int curr_spend,Person *person){
-    // sem_wait(sem2);
-    system("x-terminal-emulator");
-
-    // new terminal will be opened ... here run payment.cpp
-    // not only this program will be pausee here to do further work unit the opened terminl is close using exit 
-
-    int gen_ticket=0;
-    // ifstream infile("Curr_tranctions.txt");
-    // if (infile.is_open()) {
-    //     while (infile) {
-    //         Person person;
-    //         infile >> person.id >> person.total_spend;
-    //         if (infile) {
-    //             if(person.id==Usrid){
-    //                 if(person.total_spend>0){
-    //                     gen_ticket=1;
-    //                     break;
-    //                 }
-    //             }
-    //         }
-    //     }
-    //     infile.close();
-    // } 
-    // else cerr << "Unable to open the file for reading." << endl;
-    if(person[0].total_spend>0)
-    gen_ticket=1;
-    // sem_post(sem2);
-    return gen_ticket;
+// pays for 'hold' through the payment service's shared memory ring when one
+// runs on this host, otherwise (or if it does not answer in time) in-process
+// through the same payment library; either way the booking server decides
+int payment(int curr_spend,Person *person,uint64_t hold){
+    PaymentRequest req=paymentRequest(person[0].id,curr_spend,hold);
+    PaymentResult res;
+    if(!paymentRing.attached()||!paymentRing.call(req,res))
+        res=payments.pay(req);
+    if(res.status==PAY_OK){
+        cout<<"Booking Cost :"<<curr_spend<<"\n";
+        cout<<"Remaining Amt in Wallet :"<<res.remaining<<"\n";
+        return 1;
+    }
+    person[0].total_spend=-1;
+    if(res.status==PAY_DECLINED)
+        cout<<"Insuffiecient Balance to Book ticket\n";
+    else if(res.status==PAY_NO_HOLD)
+        cout<<"No seats are held for this booking\n";
+    else if(res.status==PAY_BAD_AMOUNT)
+        cout<<"The seats cost more than the booking price\n";
+    else if(res.status==PAY_NO_SERVER)
+        cout<<"The booking server did not answer, try again\n";
+    else
+        cout<<"Invalid credentials!!!!\n";
+    return 0;
 }
-void generate_ticket(int amt,string movie,string day,string tme, int no_of_seats,string which_seats,int hall_no,string screen){
+// which show to book: asked before the seat map because every show has its own seats
+ShowKey chooseshow(int movieidx,string &day,string &tme){
     time_t now = time(0);
-    tm* today = localtime(&now);
-    time_t tomorrow = now + 24 * 60 * 60; // Add 24 hours in seconds
-    tm* tmorrow = localtime(&tomorrow);
-    time_t dayAfterTomorrow = tomorrow + 24 * 60 * 60; // Add another 24 hours
-    tm* dayAfterTmrw = localtime(&dayAfterTomorrow);
+    int dates[3];
+    string labels[3];
+    for(int k=0;k<3;k++){
+        time_t t = now + k * 24 * 60 * 60; // today, tomorrow, day after tomorrow
+        tm* d = localtime(&t);
+        dates[k]=(d->tm_year + 1900) * 10000 + (d->tm_mon + 1) * 100 + d->tm_mday;
+        labels[k]=to_string(d->tm_mday) + "/" + to_string(d->tm_mon + 1) + "/" + to_string(d->tm_year % 100);
+    }
 
     cout<<"================================Choose Date:=================================\n";
-    cout<<"\t 1. 7/12/23\t    2. 8/12/23\t    3. 9/12/23\n";
+    cout<<"\t 1. "<<labels[0]<<"\t    2. "<<labels[1]<<"\t    3. "<<labels[2]<<"\n";
     int d;cin>>d;
-    string dt;
-    if(d==1)dt="7/12/23";
-    else if(d==2)dt="8/12/23";
-    else dt="9/12/23";
+    if(d<1||d>3)d=3;
+    day=labels[d-1];
     cout<<"==============================Select TimeSlot:================================\n";
     cout<<"A: 9:00 \tB: 11:00\tC: 13:00\n";
     cout<<"D: 15:00 \tE: 17:00\tF: 19:00\n";
     cout<<"G: 21:00 \tH: 23:00\tI: 23:30\n";
     char t;cin>>t;
+    t=toupper(t);
+    if(t<'A'||t>'I')t='A';
     vector<string>v1={"9:00","11:00","13:00","15:00","17:00","19:00","21:00","23:00","23:30"};
     tme=v1[t-65];
-    string today2,tommorow,dayaftrtom;
-    if(d==1)today2=day=to_string(today->tm_mon + 1) + "/" + to_string(today->tm_mday) + "/" + to_string(today->tm_year + 1900);
-    else if(d==2)tommorow=day=to_string(tmorrow->tm_mon + 1) + "/" + to_string(tmorrow->tm_mday) + "/" + to_string(tmorrow->tm_year + 1900);
-    else dayaftrtom=day=to_string(dayAfterTmrw->tm_mon + 1) + "/" + to_string(dayAfterTmrw->tm_mday) + "/" + to_string(dayAfterTmrw->tm_year + 1900);
+
+    ShowKey show;
+    show.movie=movieidx;
+    show.date=dates[d-1];
+    show.slot=t-65;
+    return show;
+}
+void generate_ticket(int amt,string movie,string dt,string tme, int no_of_seats,string which_seats,int hall_no,string screen){
     
     // cout<<"Congratulations !!! Your Ticket has been booked\n\n";
     // cout<<"Movie : "<<movie<<"\n";
@@ -404,28 +555,25 @@ void generate_ticket(int amt,string movie,string day,string tme, int no_of_seats
     cout<<"***************************************************************************\n";
 
 }
-int terminator(int clientSocket,Person* person,int shmid){
+int terminator(FrameConn &server){
     cout<<"Have a Nice Day !!\nDo visit again!!!!\n";
-    shmdt(person);
-    shmctl(shmid, IPC_RMID, NULL);
-    close(clientSocket);
+    close(server.fd);
     return 0;
 }
-void release_seats(int clientSocket,vector<int>&seat){
+// gives the held seats back (and the money charged for them)
+void release_seats(FrameConn &server,uint64_t hold){
  
-    const char* requestType = "5"; // Change this to test different request types
-    send(clientSocket, requestType, strlen(requestType), 0);
+    Frame reply;
+    server.callOnce(OP_RELEASE,Wire().u64(hold).buf,reply);
     
-    int book[10];
-
-    for(int i=0;i<10;i++)
-    if(i<seat.size())
-    book[i]=seat[i];
-    else
-    book[i]=-1;
+}
+// paid: turns the hold into sold seats; false if the hold expired meanwhile
+bool confirm_seats(FrameConn &server,uint64_t hold){
 
-    send(clientSocket, &book,sizeof(book), 0);
-    
+    Frame reply;
+    if(!server.callOnce(OP_CONFIRM,Wire().u64(hold).buf,reply))
+        return false;
+    return WireReader(reply.payload).u32()==0;
 }
 
 int main() {
@@ -450,22 +598,22 @@ int main() {
         perror("Connect error");
         return EXIT_FAILURE;
     }
+    FrameConn server(clientSocket);
+    payments.connect(&server); // paying in-process goes over the same connection
 
     
     // key_t key = ftok("/tmp", 'C');
     // int shmid = shmget(key, sizeof(UserData) * limituser, 0666);
     // UserData* user_data = (UserData*)shmat(shmid, NULL, 0);
 
-    int movienum=6;//give choice to admin to add movie ...by default 3 is there but space for 6 is considered
-    
     // key_t key3 = ftok("/tmp", 'M');//movie client-admin(creater)
     // int shmid3 = shmget(key3, sizeof(Movie) * movienum, 0666);
     // Movie* movie = (Movie*)shmat(shmid3, NULL, 0);
 
 
-    key_t key = ftok("/tmp", 'P');//movie client-admin(creater)
-    int shmid = shmget(key, sizeof(Person)*3, IPC_CREAT | 0666);
-    Person* person = (Person*)shmat(shmid, NULL, 0);
+    // this booking's payment details; the payment service gets a copy in its ring
+    Person person[1]={};
+    paymentRing.attach();
      
     int status=1,final_status=1;
 
@@ -475,33 +623,56 @@ int main() {
         //  cout<<"i am here2\n";
          final_status=login_signup_user();  //1
     }
-    // else if(status==-1)return terminator(user_data,movie);
-         
-    // if(final_status==0||final_status==-1){
-    //     cout<<"Too many unsuccessful attempts \n";
-    //      return terminator(user_data,movie);
-    // }
+    if(final_status==0){
+        cout<<"Too many unsuccessful attempts \n";
+        return terminator(server);
+    }
     
     int choice=0;
     int which;
     int final_amt=0;///update this as per dynamic pricing  
 
+    uint32_t listReq=search_Movies(server,"","",0);
+    server.flush();
+
     // sem_wait(sem2);
-    list_all_Movies(movienum,clientSocket); //2
+    list_all_Movies(server,listReq); //2
     // // sleep(30);
     // sem_post(sem2);
 
     int index=0,num_seats=0,hall_no=3;string name,date,time,screen="A2",which_seats="";
-    cout<<"Enter the index of the movie to be selected :";
+    cout<<"Enter the index of the movie to be selected (0 to search) :";
     cin>>index;
+    while(index==0&&cin){
+        string part,lang;int rating=0;
+        cout<<"Name or part of it (- for any) :";
+        cin>>part;
+        cout<<"Language (- for any) :";
+        cin>>lang;
+        cout<<"Minimum rating (0 for any) :";
+        cin>>rating;
+        listReq=search_Movies(server,part=="-"?"":part,lang=="-"?"":lang,rating);
+        server.flush();
+        list_all_Movies(server,listReq);
+        cout<<"Enter the index of the movie to be selected (0 to search) :";
+        cin>>index;
+    }
+    if(movies.empty()){
+        cout<<"No movies are showing right now\n";
+        return terminator(server);
+    }
+    if(index<1||index>(int)movies.size())index=1;
 
     // sem_wait(sem2);
-    final_amt+=movie[index-1].cost;
-    name=movie[index-1].name;
-    name=name+"( "+movie[index-1].lang+" )";
+    const Title &picked=movies[index-1];
+    int movie_cost=picked.cost;
+    name=picked.name;
+    name=name+"( "+picked.lang+" )";
+    hall_no=picked.screen;
     // sem_post(sem2);
 
-    showseat(clientSocket); //3
+    ShowKey show=chooseshow(picked.id,date,time);
+    showseat(server,show); //3
     
 
     // calculat ethe ammount according to movie selected and seat quality 
@@ -510,33 +681,40 @@ int main() {
      
     cout<<"Total seats to be booked :";
     cin>>num_seats; 
+    if(num_seats>10)num_seats=10;// a booking carries at most 10 seats
     vector<int>seat(num_seats,0);
-    final_amt+=selectseat(clientSocket,which_seats,seat);  //4
+    uint64_t hold=0;
+    final_amt+=selectseat(server,show,which_seats,seat,movie_cost,person,hold);  //4+5
     int gen_ticket=-1;
       
-    // update_transaction(clientSocket,final_amt); //5
-    
-    if(num_seats!=0){
+    // nothing is held when the booking failed or timed out: no payment then
+    if(hold!=0){
     //    cout<<"amt : "<<final_amt<<"\n";
-       update_transaction(clientSocket,final_amt,person); //5
        cout<<"\n1. Press P to continue to the Payment Gateway !!\n2. Press A to abort Transaction\n";
        char c;cin>>c;
        int release=0;
-       if(c=='P')
-           gen_ticket=payment(final_amt,person); //6
+       if(c=='P'){
+           gen_ticket=payment(final_amt,person,hold); //6
+           if(gen_ticket==1&&!confirm_seats(server,hold)){
+               cout<<"Your seats were held too long and have been released, the amount is refunded\n";
+               gen_ticket=-1;
+           }
+           else if(gen_ticket==0)
+               release_seats(server,hold);
+       }
        else{
-            release_seats(clientSocket,seat);
+            release_seats(server,hold);
        }
       }// if user has booked some seats
     
     if(gen_ticket==1){
-        generate_ticket(final_amt,name," 7 December 2023","3:00 PM",num_seats,which_seats,hall_no,screen); //7
+        generate_ticket(final_amt,name,date,time,num_seats,which_seats,hall_no,screen); //7
     }//generate ticket 
-    else if(num_seats!=0&& gen_ticket==0){//abort tranction 
+    else if(hold!=0&& gen_ticket==0){//abort tranction 
         cout<<"Recharge Your Wallet\n";
             }
 
-    return terminator(clientSocket,person,shmid);
+    return terminator(server);
 
 
 }
@@ -0,0 +1,128 @@
+// holds.h
+#pragma once
+// seats a client has booked but not paid for yet. A hold either gets
+// confirmed (the seats are sold), released by the client, or expires; which
+// ever comes first take()s it out of the table, the others find nothing
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "protocol.h"
+
+struct Hold
+{
+    ShowKey show;
+    std::vector<int> bits; // seat bits in the show's SeatMap
+    std::string user;
+    int charged = 0;       // taken from the wallet so far
+    int price = 0;         // what the seats cost when they were held
+    bool paid = false;     // settled through OP_PAY; price and paid are only
+                           // kept in memory, recovery releases every hold
+};
+
+class HoldTable
+{
+public:
+    explicit HoldTable(size_t nshards = 16) : nextId(((uint64_t)time(nullptr)) << 20)
+    {
+        for (size_t i = 0; i < nshards; i++)
+            shards.emplace_back(new Shard);
+    }
+
+    uint64_t add(Hold h)
+    {
+        uint64_t id = newId();
+        add(id, std::move(h));
+        return id;
+    }
+
+    // an id for a hold that is add()ed later
+    uint64_t newId() { return nextId.fetch_add(1, std::memory_order_relaxed); }
+    void add(uint64_t id, Hold h)
+    {
+        Shard &s = shardOf(id);
+        std::lock_guard<std::mutex> lk(s.m);
+        s.holds.emplace(id, std::move(h));
+    }
+
+    // removes the hold; false if it was already confirmed, released or expired
+    bool take(uint64_t id, Hold &h)
+    {
+        Shard &s = shardOf(id);
+        std::lock_guard<std::mutex> lk(s.m);
+        auto it = s.holds.find(id);
+        if (it == s.holds.end())
+            return false;
+        h = std::move(it->second);
+        s.holds.erase(it);
+        return true;
+    }
+
+    // f(Hold &) on the hold while its shard is locked; false if there is none
+    template <typename F>
+    bool update(uint64_t id, F f)
+    {
+        Shard &s = shardOf(id);
+        std::lock_guard<std::mutex> lk(s.m);
+        auto it = s.holds.find(id);
+        if (it == s.holds.end())
+            return false;
+        f(it->second);
+        return true;
+    }
+
+    // take() only if ok(const Hold &) agrees: 0 taken, 1 no such hold, 2
+    // refused (the hold stays)
+    template <typename F>
+    int takeIf(uint64_t id, Hold &h, F ok)
+    {
+        Shard &s = shardOf(id);
+        std::lock_guard<std::mutex> lk(s.m);
+        auto it = s.holds.find(id);
+        if (it == s.holds.end())
+            return 1;
+        if (!ok(it->second))
+            return 2;
+        h = std::move(it->second);
+        s.holds.erase(it);
+        return 0;
+    }
+
+    // f(id, const Hold &) for every hold, each shard locked in turn
+    template <typename F>
+    void forEach(F f)
+    {
+        for (auto &s : shards)
+        {
+            std::lock_guard<std::mutex> lk(s->m);
+            for (auto &it : s->holds)
+                f(it.first, it.second);
+        }
+    }
+
+    size_t size()
+    {
+        size_t n = 0;
+        for (auto &s : shards)
+        {
+            std::lock_guard<std::mutex> lk(s->m);
+            n += s->holds.size();
+        }
+        return n;
+    }
+
+private:
+    struct Shard
+    {
+        std::mutex m;
+        std::unordered_map<uint64_t, Hold> holds;
+    };
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> nextId;
+
+    Shard &shardOf(uint64_t id) { return *shards[id % shards.size()]; }
+};
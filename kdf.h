@@ -0,0 +1,293 @@
+// kdf.h
+#pragma once
+// password hashing for the user registry: scrypt (RFC 7914) over SHA-256.
+// scrypt needs 128 * r * N bytes of scratch memory per hash, so guessing
+// passwords costs memory as well as time; the caller keeps the scratch buffer
+// and reuses it, one per thread
+#include <sys/random.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class Sha256
+{
+public:
+    Sha256() { reset(); }
+
+    void reset()
+    {
+        static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(h, init, sizeof(h));
+        len = 0;
+        used = 0;
+    }
+
+    void update(const void *data, size_t n)
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        len += n;
+        while (n > 0)
+        {
+            size_t k = std::min(n, (size_t)64 - used);
+            memcpy(block + used, p, k);
+            used += k;
+            p += k;
+            n -= k;
+            if (used == 64)
+            {
+                compress(block);
+                used = 0;
+            }
+        }
+    }
+
+    void final(uint8_t out[32])
+    {
+        uint64_t bits = len * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != 56)
+            update(&pad, 1);
+        uint8_t be[8];
+        for (int i = 0; i < 8; i++)
+            be[i] = (uint8_t)(bits >> (56 - 8 * i));
+        update(be, 8);
+        for (int i = 0; i < 8; i++)
+            for (int j = 0; j < 4; j++)
+                out[4 * i + j] = (uint8_t)(h[i] >> (24 - 8 * j));
+    }
+
+private:
+    uint32_t h[8];
+    uint8_t block[64];
+    uint64_t len;
+    size_t used;
+
+    static uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t *b)
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)b[4 * i] << 24 | (uint32_t)b[4 * i + 1] << 16 | (uint32_t)b[4 * i + 2] << 8 | b[4 * i + 3];
+        for (int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & bb) ^ (a & c) ^ (bb & c));
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = bb;
+            bb = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += bb;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+    }
+};
+
+// PBKDF2-HMAC-SHA256 with 'iterations' rounds into out[outLen]
+inline void pbkdf2Sha256(const uint8_t *pass, size_t passLen, const uint8_t *salt, size_t saltLen, uint32_t iterations,
+                         uint8_t *out, size_t outLen)
+{
+    uint8_t key[64] = {0};
+    if (passLen > 64)
+    {
+        Sha256 s;
+        s.update(pass, passLen);
+        s.final(key);
+    }
+    else
+        memcpy(key, pass, passLen);
+    uint8_t ipad[64], opad[64];
+    for (int i = 0; i < 64; i++)
+    {
+        ipad[i] = key[i] ^ 0x36;
+        opad[i] = key[i] ^ 0x5c;
+    }
+    auto hmac = [&](const uint8_t *a, size_t an, const uint8_t *b, size_t bn, uint8_t mac[32])
+    {
+        Sha256 in, outer;
+        in.update(ipad, 64);
+        in.update(a, an);
+        in.update(b, bn);
+        uint8_t inner[32];
+        in.final(inner);
+        outer.update(opad, 64);
+        outer.update(inner, 32);
+        outer.final(mac);
+    };
+    for (uint32_t block = 1; outLen > 0; block++)
+    {
+        uint8_t be[4] = {(uint8_t)(block >> 24), (uint8_t)(block >> 16), (uint8_t)(block >> 8), (uint8_t)block};
+        uint8_t u[32], t[32];
+        hmac(salt, saltLen, be, 4, u);
+        memcpy(t, u, 32);
+        for (uint32_t i = 1; i < iterations; i++)
+        {
+            hmac(u, 32, nullptr, 0, u);
+            for (int j = 0; j < 32; j++)
+                t[j] ^= u[j];
+        }
+        size_t k = std::min(outLen, (size_t)32);
+        memcpy(out, t, k);
+        out += k;
+        outLen -= k;
+    }
+}
+
+// scrypt with N = 2^logN; 'scratch' grows to 128 * r * (N + 2) bytes and is
+// kept for the next call
+inline void scrypt(const std::string &password, const uint8_t *salt, size_t saltLen, int logN, int r, int p,
+                   uint8_t *out, size_t outLen, std::vector<uint32_t> &scratch)
+{
+    const size_t words = 32 * r; // one block of 128 * r bytes
+    const uint64_t n = 1ULL << logN;
+    std::vector<uint8_t> b(128 * r * p);
+    pbkdf2Sha256((const uint8_t *)password.data(), password.size(), salt, saltLen, 1, b.data(), b.size());
+    scratch.resize(words * (n + 2));
+    uint32_t *v = scratch.data(), *x = v + words * n, *y = x + words;
+
+    auto salsa = [](uint32_t bx[16])
+    {
+        uint32_t w[16];
+        memcpy(w, bx, sizeof(w));
+        auto R = [](uint32_t a, int s) { return (a << s) | (a >> (32 - s)); };
+        for (int i = 0; i < 8; i += 2)
+        {
+            w[4] ^= R(w[0] + w[12], 7);   w[8] ^= R(w[4] + w[0], 9);
+            w[12] ^= R(w[8] + w[4], 13);  w[0] ^= R(w[12] + w[8], 18);
+            w[9] ^= R(w[5] + w[1], 7);    w[13] ^= R(w[9] + w[5], 9);
+            w[1] ^= R(w[13] + w[9], 13);  w[5] ^= R(w[1] + w[13], 18);
+            w[14] ^= R(w[10] + w[6], 7);  w[2] ^= R(w[14] + w[10], 9);
+            w[6] ^= R(w[2] + w[14], 13);  w[10] ^= R(w[6] + w[2], 18);
+            w[3] ^= R(w[15] + w[11], 7);  w[7] ^= R(w[3] + w[15], 9);
+            w[11] ^= R(w[7] + w[3], 13);  w[15] ^= R(w[11] + w[7], 18);
+            w[1] ^= R(w[0] + w[3], 7);    w[2] ^= R(w[1] + w[0], 9);
+            w[3] ^= R(w[2] + w[1], 13);   w[0] ^= R(w[3] + w[2], 18);
+            w[6] ^= R(w[5] + w[4], 7);    w[7] ^= R(w[6] + w[5], 9);
+            w[4] ^= R(w[7] + w[6], 13);   w[5] ^= R(w[4] + w[7], 18);
+            w[11] ^= R(w[10] + w[9], 7);  w[8] ^= R(w[11] + w[10], 9);
+            w[9] ^= R(w[8] + w[11], 13);  w[10] ^= R(w[9] + w[8], 18);
+            w[12] ^= R(w[15] + w[14], 7); w[13] ^= R(w[12] + w[15], 9);
+            w[14] ^= R(w[13] + w[12], 13); w[15] ^= R(w[14] + w[13], 18);
+        }
+        for (int i = 0; i < 16; i++)
+            bx[i] += w[i];
+    };
+    // BlockMix: in (2r 64-byte blocks) -> out, even blocks first then odd
+    auto blockMix = [&](const uint32_t *in, uint32_t *outb)
+    {
+        uint32_t t[16];
+        memcpy(t, in + (2 * r - 1) * 16, 64);
+        for (int i = 0; i < 2 * r; i++)
+        {
+            for (int j = 0; j < 16; j++)
+                t[j] ^= in[i * 16 + j];
+            salsa(t);
+            memcpy(outb + ((i & 1) * r + i / 2) * 16, t, 64);
+        }
+    };
+
+    for (int chunk = 0; chunk < p; chunk++)
+    {
+        uint8_t *bp = b.data() + 128 * r * chunk;
+        for (size_t i = 0; i < words; i++)
+            x[i] = (uint32_t)bp[4 * i] | (uint32_t)bp[4 * i + 1] << 8 | (uint32_t)bp[4 * i + 2] << 16 |
+                   (uint32_t)bp[4 * i + 3] << 24;
+        for (uint64_t i = 0; i < n; i++)
+        {
+            memcpy(v + i * words, x, words * 4);
+            blockMix(x, y);
+            std::swap(x, y);
+        }
+        for (uint64_t i = 0; i < n; i++)
+        {
+            uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+            for (size_t k = 0; k < words; k++)
+                x[k] ^= v[j * words + k];
+            blockMix(x, y);
+            std::swap(x, y);
+        }
+        for (size_t i = 0; i < words; i++)
+            for (int k = 0; k < 4; k++)
+                bp[4 * i + k] = (uint8_t)(x[i] >> (8 * k));
+    }
+    pbkdf2Sha256((const uint8_t *)password.data(), password.size(), b.data(), b.size(), 1, out, outLen);
+}
+
+// compares without stopping at the first difference, so the time taken does
+// not tell how much of a hash matched
+inline bool sameBytes(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < n; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+// what the registry stores instead of a password
+struct PasswordHash
+{
+    uint8_t logN, r, p; // scrypt cost the hash was made with
+    uint8_t pad;
+    uint8_t salt[16];
+    uint8_t hash[32];
+};
+static_assert(sizeof(PasswordHash) == 52, "PasswordHash is stored in user records");
+
+// a hash of password with a fresh random salt
+inline PasswordHash hashPassword(const std::string &password, int logN, int r, int p, std::vector<uint32_t> &scratch)
+{
+    PasswordHash h{};
+    h.logN = logN;
+    h.r = r;
+    h.p = p;
+    size_t got = 0;
+    while (got < sizeof(h.salt))
+    {
+        ssize_t n = getrandom(h.salt + got, sizeof(h.salt) - got, 0);
+        if (n > 0)
+            got += n;
+    }
+    scrypt(password, h.salt, sizeof(h.salt), logN, r, p, h.hash, sizeof(h.hash), scratch);
+    return h;
+}
+
+// true if password is the one h was made from
+inline bool checkPassword(const std::string &password, const PasswordHash &h, std::vector<uint32_t> &scratch)
+{
+    if (h.logN == 0 || h.logN > 24 || h.r == 0 || h.p == 0)
+        return false; // not a hash we made
+    uint8_t out[32];
+    scrypt(password, h.salt, sizeof(h.salt), h.logN, h.r, h.p, out, sizeof(out), scratch);
+    return sameBytes(out, h.hash, sizeof(out));
+}
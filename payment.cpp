@@ -1,91 +1,68 @@
 #include <iostream>
-#include <sys/ipc.h>
-#include <sys/shm.h>
 #include <cstring>
 #include <unistd.h>
 #include <cstdlib>
-#include <fstream>
 #include <string>
-#include <vector>
-#include <fcntl.h>
-#include <ctime>
-#include<semaphore.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "paymentsvc.h"
+#include "paymentring.h"
 
 using namespace std;
 
-int is_new=1;
+const char* AdminserverIP = "127.0.0.1";  // the booking server the payments are made on
+const int serverAdmin_client_other = 12347;
 
-struct Person {
-    char id[50];
-    int curr_bal;
-    int total_spend;
-};
-
-int show_current_balance(Person *person){
-     cout<<"Into_show_current_bal fnc\n";
-    int curr_bal=person[0].curr_bal;
-
-    cout << "Current Balance : "<<curr_bal<<"\n";
-    return curr_bal;
-}
-int extract_spend(Person *person){
-    return person[0].total_spend;
-}
-int update_new_balance(int present_bal,int spend){
-  return present_bal-spend;
+// a connection to the booking server, -1 if it cannot be reached
+int connectadmin(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(serverAdmin_client_other);
+    if (fd == -1 || inet_pton(AF_INET, AdminserverIP, &serverAddr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        perror("Connect error");
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
 }
 
+// payment service: answers the payments clients queue in the shared memory
+// ring by settling them on the booking server (OP_PAY). Start it once per
+// host (more copies share the work); clients that find no service pay
+// in-process instead
 int main() {
 
-    key_t key = ftok("/tmp", 'P');//movie client-admin(creater)
-    int shmid = shmget(key, sizeof(Person)*3, 0666);
-    Person* person = (Person*)shmat(shmid, NULL, 0);
-    
-     char userid[50];
-    cout<<"Enter Your userId :";
-   
-    cin>>userid;
-    
-    // cout<<person[0].id<<"\n";
-    cout<<"hi\n";
-    if(person != nullptr){
-    if(strcmp(userid,person[0].id)==0||userid=="sr"){
-         int balance=show_current_balance(person); //1
-         int spend=extract_spend(person);//2
-             if(spend>balance){
-                person[0].total_spend=-1;
-                cout<<"Insuffiecient Balance to Book ticket";
-                cout<<"Type"<<" exit "<< "in current terminal to return "<<"\n";
-                shmdt(person);
-                return 0;}
-
-        cout<<"Booking Cost :"<<spend<<"\n";
-        int newBalance=update_new_balance(balance,spend);//3
-        if(newBalance<0){
-            cout<<" Transation Aborted : Insufficient Account Balance \n";
-        }
-        else{
-            cout<<"Remaining Amt in Wallet :"<<newBalance
-            <<"\n";
-            
-        }
-    }
-    else{
-        cout<<"Invalid credentials!!!!\n";
-        cout<<"Wrong Username!!\n";
-        cout<<"Type"<<" exit "<< "in current terminal to return to generate Ticket"<<"\n";
-        shmdt(person);
-        return 0;
-    }
+    PaymentRing ring;
+    if(!ring.create()){
+        cerr << "Error: payment ring not created." << endl;
+        return 1;
     }
-    else{
-          cerr << "Error: Shared memory not attached." << endl;
-    return 1; 
-    }
-
+    cout<<"Payment service "<<getpid()<<" ready"<<endl;
 
-     
-    
-    cout<<"Type"<<" exit "<< "in current terminal to return to generate Ticket"<<"\n";
-    shmdt(person);
+    FrameConn server(connectadmin());
+    PaymentService payments(&server);
+    ring.serve([&](const PaymentRequest &req){
+        PaymentResult res=payments.pay(req);
+        if(res.status==PAY_NO_SERVER){
+            // the server went away: reconnect and try once more
+            if(server.fd!=-1)
+                close(server.fd);
+            server=FrameConn(connectadmin());
+            res=payments.pay(req);
+        }
+        if(res.status==PAY_OK)
+            cout<<req.user<<" : Booking Cost :"<<req.spend<<"  Remaining Amt in Wallet :"<<res.remaining<<endl;
+        else if(res.status==PAY_DECLINED)
+            cout<<req.user<<" : Insuffiecient Balance to Book ticket"<<endl;
+        else if(res.status==PAY_NO_HOLD)
+            cout<<req.user<<" : No seats held for booking "<<req.ref<<endl;
+        else if(res.status==PAY_NO_SERVER)
+            cout<<req.user<<" : Booking server unreachable"<<endl;
+        else
+            cout<<req.user<<" : Invalid credentials!!!!"<<endl;
+        return res;
+    });
 }
@@ -0,0 +1,309 @@
+// paymentring.h
+#pragma once
+// payment hand-off between clients and the payment service on one host,
+// through a System V shared memory segment (ftok("/tmp", 'P')).
+// Requests go through a bounded multi-producer multi-consumer ring: every cell
+// carries a sequence number telling whose turn it is (free for position p when
+// seq == p, holding the request of position p when seq == p + 1), so any
+// number of clients can queue and any number of payment.cpp processes can
+// take requests without locks. Answers do not go back through the ring: a
+// client owns one reply slot while it waits and sleeps on its state word with
+// a futex; the service sleeps on 'posted' when the ring is empty. Nobody polls
+#include <linux/futex.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include "paymentsvc.h"
+
+const uint32_t paymentRingSlots = 256; // power of two
+const uint32_t paymentRingFormat = 3; // 3: PaymentRequest is user, spend and hold
+
+struct PaymentCell
+{
+    std::atomic<uint64_t> seq;
+    uint64_t ticket;  // ring position the request was queued at
+    uint32_t reply;   // reply slot of the client waiting for it
+    uint32_t pad;
+    PaymentRequest req;
+};
+
+struct alignas(64) PaymentReply
+{
+    std::atomic<uint32_t> state; // futex word: 0 free, 1 waiting, 2 answered, 3 given up by the client
+    uint32_t pad;
+    uint64_t ticket;             // of the request the client waits for
+    PaymentResult res;
+};
+
+struct PaymentRingShm
+{
+    std::atomic<uint32_t> ready; // 0 new, 1 being set up, 2 usable
+    uint32_t format, capacity;
+    alignas(64) std::atomic<uint64_t> head; // next position to queue at
+    alignas(64) std::atomic<uint64_t> tail; // next position to take
+    alignas(64) std::atomic<uint32_t> posted; // futex word, bumped per queued request
+    std::atomic<uint32_t> sleepers;           // services waiting on 'posted'
+    std::atomic<uint64_t> answered;
+    PaymentCell cells[paymentRingSlots];
+    PaymentReply replies[paymentRingSlots];
+};
+
+inline long futexWait(std::atomic<uint32_t> *word, uint32_t expect, const timespec *timeout)
+{
+    // not FUTEX_PRIVATE: the word is shared between processes
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expect, timeout, nullptr, 0);
+}
+inline void futexWake(std::atomic<uint32_t> *word, int n)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, n, nullptr, nullptr, 0);
+}
+
+class PaymentRing
+{
+public:
+    PaymentRing() = default;
+    PaymentRing(const PaymentRing &) = delete;
+    PaymentRing &operator=(const PaymentRing &) = delete;
+    ~PaymentRing()
+    {
+        if (ring != nullptr)
+            shmdt(ring);
+    }
+
+    // payment service: creates the ring, or joins the one another service
+    // already set up. A segment of another size (the old Person[3] hand-off)
+    // or a ring of another format is removed first
+    bool create()
+    {
+        key_t key = ftok("/tmp", 'P');
+        int id = shmget(key, sizeof(PaymentRingShm), IPC_CREAT | 0666);
+        if (id == -1 && errno == EINVAL)
+        {
+            int old = shmget(key, 0, 0666);
+            if (old != -1)
+                shmctl(old, IPC_RMID, nullptr);
+            id = shmget(key, sizeof(PaymentRingShm), IPC_CREAT | 0666);
+        }
+        if (id == -1 || !map(id))
+            return false;
+        if (ring->ready.load(std::memory_order_acquire) == 2 && !usable())
+        {
+            shmdt(ring);
+            ring = nullptr;
+            shmctl(id, IPC_RMID, nullptr);
+            id = shmget(key, sizeof(PaymentRingShm), IPC_CREAT | 0666);
+            if (id == -1 || !map(id))
+                return false;
+        }
+        uint32_t st = 0;
+        if (ring->ready.compare_exchange_strong(st, 1, std::memory_order_acq_rel))
+        {
+            ring->format = paymentRingFormat;
+            ring->capacity = paymentRingSlots;
+            for (uint32_t i = 0; i < paymentRingSlots; i++)
+                ring->cells[i].seq.store(i, std::memory_order_relaxed);
+            ring->ready.store(2, std::memory_order_release);
+        }
+        while (ring->ready.load(std::memory_order_acquire) != 2)
+            sched_yield();
+        return usable();
+    }
+
+    // client: false when no payment service ever set the ring up
+    bool attach()
+    {
+        int id = shmget(ftok("/tmp", 'P'), sizeof(PaymentRingShm), 0666);
+        if (id == -1 || !map(id))
+            return false;
+        if (ring->ready.load(std::memory_order_acquire) == 2 && usable())
+            return true;
+        shmdt(ring);
+        ring = nullptr;
+        return false;
+    }
+
+    bool attached() const { return ring != nullptr; }
+
+    // client: queues the request and sleeps until a service answers it;
+    // false if the ring is full or nobody answered within timeoutMs (the
+    // caller can then pay another way, a late answer is thrown away)
+    bool call(const PaymentRequest &req, PaymentResult &res, int timeoutMs = 2000)
+    {
+        uint32_t slot;
+        if (!claimReply(slot))
+            return false;
+        PaymentReply &r = ring->replies[slot];
+        uint64_t pos;
+        PaymentCell *c = reserve(pos);
+        if (c == nullptr)
+        {
+            r.state.store(0, std::memory_order_release);
+            return false;
+        }
+        r.ticket = pos;
+        c->ticket = pos;
+        c->reply = slot;
+        c->req = req;
+        c->seq.store(pos + 1, std::memory_order_release);
+        ring->posted.fetch_add(1);
+        if (ring->sleepers.load() > 0)
+            futexWake(&ring->posted, 1);
+
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (r.state.load(std::memory_order_acquire) == 1)
+        {
+            timespec now, left;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0)
+            {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000;
+            }
+            if (left.tv_sec < 0)
+            {
+                uint32_t waiting = 1;
+                if (r.state.compare_exchange_strong(waiting, 3, std::memory_order_acq_rel))
+                    return false; // the service frees the slot when it gets to the request
+                break;            // answered just now
+            }
+            futexWait(&r.state, 1, &left);
+        }
+        res = r.res;
+        bool mine = r.ticket == pos && res.ref == req.ref;
+        r.state.store(0, std::memory_order_release);
+        return mine;
+    }
+
+    // payment service: takes requests one at a time, sleeping while there
+    // are none, and answers each with handle(request); never returns
+    template <typename F>
+    void serve(F handle)
+    {
+        while (true)
+        {
+            PaymentCell taken;
+            if (!take(taken))
+            {
+                ring->sleepers.fetch_add(1);
+                uint32_t seen = ring->posted.load();
+                bool got = take(taken);
+                if (!got)
+                    futexWait(&ring->posted, seen, nullptr);
+                ring->sleepers.fetch_sub(1);
+                if (!got)
+                    continue;
+            }
+            PaymentReply &r = ring->replies[taken.reply % paymentRingSlots];
+            if (r.ticket != taken.ticket)
+                continue; // not the request this slot waits for
+            r.res = handle(taken.req);
+            ring->answered.fetch_add(1, std::memory_order_relaxed);
+            uint32_t waiting = 1;
+            if (r.state.compare_exchange_strong(waiting, 2, std::memory_order_acq_rel))
+                futexWake(&r.state, 1);
+            else if (waiting == 3)
+                r.state.store(0, std::memory_order_release); // the client gave up
+        }
+    }
+
+    uint64_t answeredCount() const { return ring->answered.load(std::memory_order_relaxed); }
+    uint64_t queued() const
+    {
+        return ring->head.load(std::memory_order_relaxed) - ring->tail.load(std::memory_order_relaxed);
+    }
+
+private:
+    PaymentRingShm *ring = nullptr;
+
+    bool map(int id)
+    {
+        void *p = shmat(id, nullptr, 0);
+        if (p == (void *)-1)
+        {
+            perror("payment ring shmat");
+            return false;
+        }
+        ring = static_cast<PaymentRingShm *>(p);
+        return true;
+    }
+
+    bool usable() const { return ring->format == paymentRingFormat && ring->capacity == paymentRingSlots; }
+
+    // a free reply slot, looked for from a place that depends on the pid so
+    // clients do not all fight over slot 0
+    bool claimReply(uint32_t &slot)
+    {
+        uint32_t start = (uint32_t)getpid() * 2654435761u;
+        for (uint32_t i = 0; i < paymentRingSlots; i++)
+        {
+            slot = (start + i) % paymentRingSlots;
+            uint32_t st = 0;
+            if (ring->replies[slot].state.compare_exchange_strong(st, 1, std::memory_order_acq_rel))
+                return true;
+        }
+        return false;
+    }
+
+    // the cell to queue at; nullptr when the ring is full
+    PaymentCell *reserve(uint64_t &pos)
+    {
+        pos = ring->head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            PaymentCell *c = &ring->cells[pos % paymentRingSlots];
+            int64_t diff = (int64_t)(c->seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0)
+            {
+                if (ring->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return c;
+            }
+            else if (diff < 0)
+                return nullptr;
+            else
+                pos = ring->head.load(std::memory_order_relaxed);
+        }
+    }
+
+    // copies out the oldest request; false when there is none
+    bool take(PaymentCell &out)
+    {
+        uint64_t pos = ring->tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            PaymentCell *c = &ring->cells[pos % paymentRingSlots];
+            int64_t diff = (int64_t)(c->seq.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0)
+            {
+                if (ring->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    out.ticket = c->ticket;
+                    out.reply = c->reply;
+                    out.req = c->req;
+                    c->seq.store(pos + paymentRingSlots, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = ring->tail.load(std::memory_order_relaxed);
+        }
+    }
+};
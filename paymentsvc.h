@@ -0,0 +1,88 @@
+// paymentsvc.h
+#pragma once
+// the payment step as a plain library call: client.cpp links it in and pays
+// in-process, payment.cpp wraps the same code for the shared memory hand-off.
+// The decision is the booking server's: a payment is an OP_PAY for the hold,
+// which checks the hold belongs to the user, takes whatever of its price the
+// booking did not already charge from the user's wallet, and marks it paid;
+// OP_CONFIRM only sells a hold that went through this. Nothing the caller
+// says about balances is believed. Besides counters the service only has the
+// connection to the server, so one thread pays through it at a time
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "protocol.h"
+
+const int payUserLen = 50; // same as Person::id
+
+struct PaymentRequest
+{
+    char user[payUserLen]; // who pays
+    int32_t spend;         // the most the user agreed to pay
+    uint64_t ref;          // the server's hold id, echoed back; 0 = nothing held
+};
+
+enum PaymentStatus : int32_t
+{
+    PAY_OK = 0,
+    PAY_DECLINED = 1,    // the wallet does not cover the price
+    PAY_BAD_USER = 2,    // no user, or not the one the booking was made for
+    PAY_BAD_AMOUNT = 3,  // the seats cost more than spend
+    PAY_NO_HOLD = 4,     // the server holds no seats for it (released or expired)
+    PAY_NO_SERVER = 5,   // the booking server did not answer
+};
+
+struct PaymentResult
+{
+    int32_t status;    // PaymentStatus
+    int32_t remaining; // wallet balance on the server after paying
+    uint64_t ref;
+};
+
+class PaymentService
+{
+public:
+    explicit PaymentService(FrameConn *server = nullptr) : server(server) {}
+
+    // the booking server connection OP_PAY goes through
+    void connect(FrameConn *s) { server = s; }
+
+    PaymentResult pay(const PaymentRequest &r)
+    {
+        PaymentResult res{PAY_NO_SERVER, 0, r.ref};
+        Frame reply;
+        if (r.user[0] == '\0' || strnlen(r.user, payUserLen) == payUserLen)
+            res.status = PAY_BAD_USER;
+        else if (r.ref == 0)
+            res.status = PAY_NO_HOLD;
+        else if (server != nullptr && server->callOnce(OP_PAY, Wire().u64(r.ref).str(r.user).i32(r.spend).buf, reply))
+        {
+            WireReader in(reply.payload);
+            int32_t status = in.u32();
+            int32_t balance = in.i32();
+            if (in.ok)
+            {
+                res.status = status;
+                res.remaining = balance;
+            }
+        }
+        (res.status == PAY_OK ? approved : declined).fetch_add(1, std::memory_order_relaxed);
+        return res;
+    }
+
+    uint64_t approvedCount() const { return approved.load(std::memory_order_relaxed); }
+    uint64_t declinedCount() const { return declined.load(std::memory_order_relaxed); }
+
+private:
+    FrameConn *server;
+    std::atomic<uint64_t> approved{0}, declined{0};
+};
+
+inline PaymentRequest paymentRequest(const char *user, int spend, uint64_t hold)
+{
+    PaymentRequest r{};
+    memcpy(r.user, user, strnlen(user, payUserLen - 1));
+    r.spend = spend;
+    r.ref = hold;
+    return r;
+}
@@ -0,0 +1,284 @@
+// pricing.h
+#pragma once
+// seat prices per show and tier. Every show keeps a price card: one cache
+// line with the current price of each tier, written only when something that
+// goes into the price changes, so a quote is a read of that line and never a
+// calculation. A price is
+//     tier base * occupancy band % * every calendar period the date is in %
+// The band only moves when a booking or release crosses its edge, the
+// calendar (festivals, seasons) only when the rules are reloaded; both are
+// applied by rewriting the affected cards, the rules by a pass over all shows
+// off the request path.
+// Rules file, one rule per line ('#' comments and blank lines are skipped):
+//     tier,<name>,<base price>                front to back, one per venue tier
+//     band,<from % full>,<price %>            the highest band reached applies
+//     festival|season,<first yyyymmdd>,<last yyyymmdd>,<price %>,<name>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "seatbitset.h"
+#include "seatfinder.h"
+
+struct PriceRules
+{
+    struct Tier
+    {
+        std::string name;
+        int32_t base;
+    };
+    struct Band
+    {
+        int32_t from;    // % of the seats taken
+        int32_t percent; // of the base price
+    };
+    struct Period
+    {
+        std::string kind; // festival or season
+        int32_t first, last; // yyyymmdd, both included
+        int32_t percent;
+        std::string name;
+    };
+    std::vector<Tier> tiers;
+    std::vector<Band> bands; // ascending 'from', the first starts at 0
+    std::vector<Period> calendar;
+
+    // the 3 tiers of defaultHall(), dearer when it fills up, no calendar
+    static PriceRules defaults()
+    {
+        PriceRules r;
+        r.tiers = {{"PREMIUM", 70}, {"BUSINESS", 50}, {"ECONOMY", 40}};
+        r.bands = {{0, 100}, {50, 110}, {80, 125}, {95, 150}};
+        return r;
+    }
+
+    // which band 'taken' of 'seats' is in
+    int bandOf(int taken, int seats) const
+    {
+        int full = seats > 0 ? (int)((int64_t)taken * 100 / seats) : 0;
+        int b = 0;
+        while (b + 1 < (int)bands.size() && bands[b + 1].from <= full)
+            b++;
+        return b;
+    }
+
+    int32_t price(int tier, int band, int32_t date) const
+    {
+        int64_t p = (int64_t)tiers[tier].base * bands[band].percent;
+        for (const Period &d : calendar)
+            if (date >= d.first && date <= d.last)
+                p = p * d.percent / 100;
+        return (int32_t)std::min<int64_t>(p / 100, INT32_MAX);
+    }
+
+    // false (and the line that is wrong in 'error') if 'text' does not parse
+    bool parse(const std::string &text, std::string &error)
+    {
+        *this = PriceRules();
+        std::istringstream lines(text);
+        std::string line;
+        for (int at = 1; std::getline(lines, line); at++)
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::vector<std::string> f;
+            std::istringstream fields(line);
+            for (std::string s; std::getline(fields, s, ',');)
+                f.push_back(s);
+            bool ok = false;
+            if (f[0] == "tier" && f.size() == 3)
+            {
+                int32_t base = number(f[2], 0, 1000000);
+                if ((ok = base >= 0))
+                    tiers.push_back({f[1], base});
+            }
+            else if (f[0] == "band" && f.size() == 3)
+            {
+                int32_t from = number(f[1], 0, 100), percent = number(f[2], 1, 1000);
+                if ((ok = from >= 0 && percent >= 0 && (bands.empty() || bands.back().from < from)))
+                    bands.push_back({from, percent});
+            }
+            else if ((f[0] == "festival" || f[0] == "season") && f.size() == 5)
+            {
+                int32_t first = number(f[1], 19000101, 99991231), last = number(f[2], 19000101, 99991231);
+                int32_t percent = number(f[3], 1, 1000);
+                if ((ok = first >= 0 && last >= first && percent >= 0))
+                    calendar.push_back({f[0], first, last, percent, f[4]});
+            }
+            if (!ok)
+            {
+                error = "line " + std::to_string(at) + ": " + line;
+                return false;
+            }
+        }
+        if (tiers.empty())
+            error = "no tier prices";
+        else if (bands.empty() || bands[0].from != 0)
+            error = "the first band has to start at 0";
+        return error.empty();
+    }
+
+private:
+    // s as a number in [lo, hi], else -1
+    static int32_t number(const std::string &s, int32_t lo, int32_t hi)
+    {
+        if (s.empty() || s.size() > 9 || s.find_first_not_of("0123456789") != std::string::npos)
+            return -1;
+        int32_t v = std::stoi(s);
+        return v >= lo && v <= hi ? v : -1;
+    }
+};
+
+// one show's prices, a cache line of its own. Written under a sequence lock:
+// 'seq' is odd while a writer is in, a reader retries if it saw it odd or
+// changed. Writers lock out each other by making it odd
+struct alignas(64) PriceCard
+{
+    static const int maxTiers = 13;
+
+    std::atomic<uint32_t> seq{0};
+    std::atomic<uint32_t> rules{0}; // generation of the rules it was priced with, 0 = not yet
+    std::atomic<int32_t> band{0};
+    std::atomic<int32_t> price[maxTiers] = {};
+};
+static_assert(sizeof(PriceCard) == 64, "a price card is one cache line");
+
+// what a card said at one moment
+struct Quote
+{
+    uint32_t rules = 0;
+    int32_t band = 0;
+    int32_t price[PriceCard::maxTiers] = {};
+};
+
+class Pricing
+{
+public:
+    explicit Pricing(const Venue &v) : venue(v), tierOfRow(v.rows, (int)v.tiers.size() - 1)
+    {
+        for (size_t t = 0; t < v.tiers.size(); t++)
+            for (int r = std::max(v.tiers[t].first, 0); r <= std::min(v.tiers[t].second, v.rows - 1); r++)
+                tierOfRow[r] = t;
+        std::string unused;
+        set(PriceRules::defaults(), unused);
+    }
+    Pricing(const Pricing &) = delete;
+    Pricing &operator=(const Pricing &) = delete;
+
+    // publishes new rules; false (and why in 'error') if they do not fit the
+    // venue. Cards keep the old prices until they are repriced
+    bool set(PriceRules r, std::string &error)
+    {
+        if (r.tiers.size() != venue.tiers.size() || r.tiers.size() > (size_t)PriceCard::maxTiers)
+        {
+            error = "the hall has " + std::to_string(venue.tiers.size()) + " tiers, the rules price " +
+                    std::to_string(r.tiers.size());
+            return false;
+        }
+        std::lock_guard<std::mutex> lk(m);
+        published.emplace_back(new Rules{std::move(r), (uint32_t)published.size() + 1});
+        current.store(published.back().get(), std::memory_order_release);
+        return true;
+    }
+
+    bool load(const std::string &path, std::string &error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot read " + path;
+            return false;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        PriceRules r;
+        return r.parse(text.str(), error) && set(std::move(r), error);
+    }
+
+    const PriceRules *rules() const { return &current.load(std::memory_order_acquire)->rules; }
+
+    // a booking or release just changed the show's seats; rewrites the card
+    // only if that moved it to another band or it predates the rules. Finding
+    // out takes no lock and writes nothing, so quotes are not disturbed
+    void occupancy(PriceCard &card, int32_t date, const SeatMap &seats)
+    {
+        const Rules *r = current.load(std::memory_order_acquire);
+        int band = r->rules.bandOf(seats.takenCount(), venue.rows * venue.cols);
+        uint32_t s = card.seq.load(std::memory_order_acquire);
+        if (!(s & 1) && card.rules.load(std::memory_order_relaxed) == r->generation &&
+            card.band.load(std::memory_order_relaxed) == band)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (card.seq.load(std::memory_order_relaxed) == s)
+                return;
+        }
+        write(card, date, seats, false);
+    }
+
+    // prices the card with the current rules whatever it had
+    void reprice(PriceCard &card, int32_t date, const SeatMap &seats) { write(card, date, seats, true); }
+
+    Quote quote(const PriceCard &card) const
+    {
+        Quote q;
+        while (true)
+        {
+            uint32_t s = card.seq.load(std::memory_order_acquire);
+            if (s & 1)
+                continue;
+            q.rules = card.rules.load(std::memory_order_relaxed);
+            q.band = card.band.load(std::memory_order_relaxed);
+            for (int t = 0; t < PriceCard::maxTiers; t++)
+                q.price[t] = card.price[t].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (card.seq.load(std::memory_order_relaxed) == s)
+                return q;
+        }
+    }
+
+    int tierOf(int seatBit) const { return tierOfRow[seatBit / venue.cols]; }
+    const Venue &layout() const { return venue; }
+
+private:
+    struct Rules
+    {
+        PriceRules rules;
+        uint32_t generation; // 1, 2, ... in the order they were set
+    };
+
+    const Venue venue;
+    std::vector<int> tierOfRow;
+    // every set of rules ever published stays, readers never have to pin
+    // one; they are a few hundred bytes and only change by hand
+    std::mutex m; // guards published
+    std::vector<std::unique_ptr<const Rules>> published;
+    std::atomic<const Rules *> current{nullptr};
+
+    void write(PriceCard &card, int32_t date, const SeatMap &seats, bool always)
+    {
+        uint32_t s = card.seq.load(std::memory_order_relaxed);
+        while ((s & 1) || !card.seq.compare_exchange_weak(s, s + 1, std::memory_order_acquire))
+            s = card.seq.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        // rules and occupancy are read under the card's lock, so the last
+        // writer of a card has the newest of both
+        const Rules *r = current.load(std::memory_order_acquire);
+        int band = r->rules.bandOf(seats.takenCount(), venue.rows * venue.cols);
+        if (always || card.rules.load(std::memory_order_relaxed) != r->generation ||
+            card.band.load(std::memory_order_relaxed) != band)
+        {
+            card.rules.store(r->generation, std::memory_order_relaxed);
+            card.band.store(band, std::memory_order_relaxed);
+            for (size_t t = 0; t < r->rules.tiers.size(); t++)
+                card.price[t].store(r->rules.price(t, band, date), std::memory_order_relaxed);
+        }
+        card.seq.store(s + 2, std::memory_order_release);
+    }
+};
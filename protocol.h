@@ -0,0 +1,469 @@
+// protocol.h
+#pragma once
+// wire format between client.cpp and the admin booking server (port 12347)
+//
+// every message is a frame: 12 byte header followed by 'len' payload bytes
+//   byte 0     version (protoVersion)
+//   byte 1     opcode
+//   bytes 2-3  flags (FLAG_*)
+//   bytes 4-7  request id, echoed back in the reply
+//   bytes 8-11 payload length
+// all integers on the wire (header and payload) are little endian
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+const uint8_t protoVersion = 1;
+const size_t frameHeaderLen = 12;
+const uint32_t maxFrameLen = 1 << 20; // anything bigger is a broken peer
+
+enum Opcode : uint8_t
+{
+    // 'show' = i32 movie index, i32 date (yyyymmdd), i32 time slot (0-8)
+    OP_LIST = 1,        // -> u64 catalog version, u32 n, title[n] (catalog.h)
+    OP_SEATMAP = 2,     // show -> u16 rows, u16 cols, u64 words[]
+    // booked seats are held until confirmed or released, or until the hold expires
+    OP_BOOK = 3,        // show, i32 seat[10] -> u32 conflict mask (bit i = seat[i]), u64 hold
+    OP_WALLET = 4,      // user id -> i32 balance
+    OP_RELEASE = 5,     // u64 hold -> u32 status (0 released, 1 unknown or expired)
+    // 6 was OP_WALLET_SET; balances are only set from the admin console now
+    // spend is the most the client agrees to pay; the server charges the
+    // show's current price (movie price + seats) and books nothing if it is
+    // more than that (hold 0, price says what it is now)
+    OP_BOOK_CHARGE = 7, // show, i32 seat[10], i32 spend, user id -> u32 conflicts, i32 balance before, i32 after, u64 hold, i32 price
+    OP_CONFIRM = 8,     // u64 hold -> u32 status (0 sold, 1 unknown or expired, 2 not paid (OP_PAY) yet, still held)
+    OP_FIND_SEATS = 9,  // show, i32 tier, i32 n -> u32 count, (i32 row, i32 col)[count] adjacent free seats
+    // show, u64 version the client has (0 = none) ->
+    //   u8 0, u64 version, u32 count, (u32 seat bit, u8 taken)[count]   changes since then
+    //   u8 1, u64 version, u16 rows, u16 cols, u64 words[]              full snapshot
+    OP_SEATMAP_SINCE = 10,
+    // show, u64 version -> same reply as OP_SEATMAP_SINCE; from then on the
+    // show's changes are pushed to this connection as OP_SEAT_EVENT
+    OP_SUBSCRIBE = 11,
+    OP_UNSUBSCRIBE = 12, // show -> u32 status (0 = was subscribed, 1 = was not)
+    // pushed with reqid 0, never requested:
+    OP_SEAT_EVENT = 13, // show, u64 version, u32 count, (u32 seat bit, u8 taken)[count]; one version each
+    OP_LAGGED = 14,     // empty; pushes were dropped because we read too slowly, catch up with OP_SEATMAP_SINCE
+    // str name (substring, or prefix if shorter than 3), str lang, i32 min rating, u32 k; empty strings match all
+    //   -> u64 catalog version, u32 n, title[n] best rated first, n <= k
+    OP_SEARCH = 15,
+    OP_QUOTE = 16,      // show -> u32 n, (i32 first row, i32 last row, i32 seat price)[n], one per tier front to back
+    // u64 hold, user id, i32 most the user pays -> u32 PaymentStatus (paymentsvc.h), i32 balance after;
+    // takes what the booking did not charge yet from the wallet and marks the hold paid
+    OP_PAY = 17,
+    OP_ERROR = 255     // -> text
+};
+
+enum FrameFlag : uint16_t
+{
+    // the payload ends with a u64 idempotency token the client picked; the
+    // server executes the request once and answers every copy of it sent
+    // within a few minutes with the first reply. Used for OP_BOOK_CHARGE,
+    // OP_CONFIRM, OP_RELEASE and OP_PAY so they can be retried after a timeout
+    FLAG_TOKEN = 1,
+};
+
+// which show a seat request is about
+struct ShowKey
+{
+    int32_t movie; // index into the catalog
+    int32_t date;  // yyyymmdd
+    int32_t slot;  // time slot 0-8 (A-I)
+
+    bool operator==(const ShowKey &o) const { return movie == o.movie && date == o.date && slot == o.slot; }
+};
+
+struct Frame
+{
+    uint8_t version = protoVersion;
+    uint8_t opcode = 0;
+    uint16_t flags = 0;
+    uint32_t reqid = 0;
+    std::string payload;
+};
+
+// payload builder
+class Wire
+{
+public:
+    std::string buf;
+
+    Wire &u8(uint8_t v)
+    {
+        buf += (char)v;
+        return *this;
+    }
+    Wire &u16(uint16_t v)
+    {
+        for (int i = 0; i < 2; i++)
+            buf += (char)(v >> (8 * i));
+        return *this;
+    }
+    Wire &u32(uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            buf += (char)(v >> (8 * i));
+        return *this;
+    }
+    Wire &u64(uint64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            buf += (char)(v >> (8 * i));
+        return *this;
+    }
+    Wire &i32(int32_t v) { return u32((uint32_t)v); }
+    Wire &show(const ShowKey &k) { return i32(k.movie).i32(k.date).i32(k.slot); }
+    Wire &bytes(const void *p, size_t n)
+    {
+        buf.append((const char *)p, n);
+        return *this;
+    }
+    // length prefixed string
+    Wire &str(const std::string &s)
+    {
+        u16((uint16_t)s.size());
+        buf += s;
+        return *this;
+    }
+};
+
+// payload reader; a short payload sets ok = false and reads as zeros
+class WireReader
+{
+public:
+    bool ok = true;
+
+    WireReader(const char *data, size_t n) : p(data), end(data + n) {}
+    WireReader(const std::string &s) : WireReader(s.data(), s.size()) {}
+
+    uint8_t u8() { return (uint8_t)take(1); }
+    uint16_t u16() { return (uint16_t)take(2); }
+    uint32_t u32() { return (uint32_t)take(4); }
+    uint64_t u64() { return take(8); }
+    int32_t i32() { return (int32_t)u32(); }
+    std::string str()
+    {
+        size_t n = u16();
+        if ((size_t)(end - p) < n)
+        {
+            ok = false;
+            return "";
+        }
+        std::string s(p, n);
+        p += n;
+        return s;
+    }
+    // n raw bytes (e.g. a struct Wire::bytes() wrote); zeroed if short
+    void bytes(void *out, size_t n)
+    {
+        if ((size_t)(end - p) < n)
+        {
+            ok = false;
+            memset(out, 0, n);
+            return;
+        }
+        memcpy(out, p, n);
+        p += n;
+    }
+    size_t left() const { return end - p; }
+
+private:
+    const char *p, *end;
+
+    uint64_t take(int n)
+    {
+        if (end - p < n)
+        {
+            ok = false;
+            p = end;
+            return 0;
+        }
+        uint64_t v = 0;
+        for (int i = 0; i < n; i++)
+            v |= (uint64_t)(uint8_t)p[i] << (8 * i);
+        p += n;
+        return v;
+    }
+};
+
+// the 12 byte header of a frame whose payload of 'len' bytes follows
+inline void putFrameHeader(std::string &out, uint8_t opcode, uint32_t reqid, size_t len, uint16_t flags = 0)
+{
+    Wire h;
+    h.u8(protoVersion).u8(opcode).u16(flags).u32(reqid).u32((uint32_t)len);
+    out += h.buf;
+}
+
+// appends one encoded frame to out; several frames can share one send()
+inline void putFrame(std::string &out, uint8_t opcode, uint32_t reqid, const std::string &payload, uint16_t flags = 0)
+{
+    putFrameHeader(out, opcode, reqid, payload.size(), flags);
+    out += payload;
+}
+
+enum class FrameStatus
+{
+    Ok,
+    NeedMore,
+    Bad
+};
+
+// decodes the frame starting at buf[pos]; on Ok pos moves past it
+inline FrameStatus takeFrame(const std::string &buf, size_t &pos, Frame &f)
+{
+    if (buf.size() - pos < frameHeaderLen)
+        return FrameStatus::NeedMore;
+    WireReader r(buf.data() + pos, frameHeaderLen);
+    f.version = r.u8();
+    f.opcode = r.u8();
+    f.flags = r.u16();
+    f.reqid = r.u32();
+    uint32_t len = r.u32();
+    if (f.version != protoVersion || len > maxFrameLen)
+        return FrameStatus::Bad;
+    if (buf.size() - pos - frameHeaderLen < len)
+        return FrameStatus::NeedMore;
+    f.payload.assign(buf, pos + frameHeaderLen, len);
+    pos += frameHeaderLen + len;
+    return FrameStatus::Ok;
+}
+
+// blocking client end of a framed connection. Outgoing frames are buffered
+// until flush(), incoming bytes are read in big chunks and cut into frames
+// from the buffer, so a reply costs one recv() at most
+class FrameConn
+{
+public:
+    int fd = -1;
+
+    explicit FrameConn(int fd = -1) : fd(fd) {}
+
+    // queues a request and returns its id
+    uint32_t queue(uint8_t opcode, const std::string &payload, uint16_t flags = 0)
+    {
+        uint32_t id = nextId++;
+        putFrame(wbuf, opcode, id, payload, flags);
+        return id;
+    }
+
+    bool flush()
+    {
+        size_t off = 0;
+        while (off < wbuf.size())
+        {
+            ssize_t w = ::send(fd, wbuf.data() + off, wbuf.size() - off, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            off += w;
+        }
+        wbuf.clear();
+        return true;
+    }
+
+    // next frame from the server, false on disconnect or garbage, or when
+    // nothing came within timeoutMs (-1 = wait for ever; timedOut tells)
+    bool next(Frame &f, int timeoutMs = -1)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        timedOut = false;
+        while (true)
+        {
+            FrameStatus st = takeFrame(rbuf, rpos, f);
+            if (st == FrameStatus::Ok)
+            {
+                if (rpos == rbuf.size())
+                {
+                    rbuf.clear();
+                    rpos = 0;
+                }
+                return true;
+            }
+            if (st == FrameStatus::Bad)
+                return false;
+            if (rpos > 0)
+            {
+                rbuf.erase(0, rpos);
+                rpos = 0;
+            }
+            if (timeoutMs >= 0)
+            {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                pollfd p{fd, POLLIN, 0};
+                int ready = left.count() > 0 ? ::poll(&p, 1, (int)left.count()) : 0;
+                if (ready < 0 && errno == EINTR)
+                    continue;
+                if (ready == 0)
+                {
+                    timedOut = true;
+                    return false;
+                }
+            }
+            char chunk[16384];
+            ssize_t r = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            rbuf.append(chunk, r);
+        }
+    }
+
+    // reply to an earlier queued (and flushed) request; replies to other ids
+    // that arrive first are parked until somebody waits for them
+    bool wait(uint32_t id, Frame &reply, int timeoutMs = -1)
+    {
+        auto it = parked.find(id);
+        if (it != parked.end())
+        {
+            reply = std::move(it->second);
+            parked.erase(it);
+            return true;
+        }
+        while (next(reply, timeoutMs))
+        {
+            if (reply.reqid == id)
+                return true;
+            park(reply);
+        }
+        return false;
+    }
+
+    // reads whatever the server already sent without blocking; false once
+    // the connection is gone
+    bool poll()
+    {
+        char chunk[16384];
+        while (true)
+        {
+            ssize_t r = ::recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (r > 0)
+            {
+                rbuf.append(chunk, r);
+                continue;
+            }
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                return false;
+            break;
+        }
+        Frame f;
+        FrameStatus st;
+        while ((st = takeFrame(rbuf, rpos, f)) == FrameStatus::Ok)
+            park(f);
+        rbuf.erase(0, rpos);
+        rpos = 0;
+        return st != FrameStatus::Bad;
+    }
+
+    // oldest frame the server pushed on its own (reqid 0), in arrival order
+    bool nextPush(Frame &f)
+    {
+        if (pushes.empty())
+            return false;
+        f = std::move(pushes.front());
+        pushes.pop_front();
+        return true;
+    }
+
+    // one request, one reply
+    bool call(uint8_t opcode, const std::string &payload, Frame &reply)
+    {
+        uint32_t id = queue(opcode, payload);
+        if (!flush())
+            return false;
+        return wait(id, reply) && reply.opcode == opcode;
+    }
+
+    // one request that must not be executed twice (a charge): it carries a
+    // fresh idempotency token and is sent again, same token, whenever no reply
+    // came within timeoutMs; the server answers every copy with the reply of
+    // the first, so whichever copy is answered first will do; replies to the
+    // other copies are dropped when they turn up
+    bool callOnce(uint8_t opcode, const std::string &payload, Frame &reply, int timeoutMs = 1000, int attempts = 5)
+    {
+        std::string body = payload;
+        uint64_t token = newToken();
+        for (int i = 0; i < 8; i++)
+            body += (char)(token >> (8 * i));
+        std::vector<uint32_t> sent;
+        bool got = false;
+        for (int attempt = 0; attempt < attempts && !got; attempt++)
+        {
+            sent.push_back(queue(opcode, body, FLAG_TOKEN));
+            if (!flush())
+                break;
+            got = waitAny(sent, reply, timeoutMs);
+            if (!got && !timedOut)
+                break;
+        }
+        for (uint32_t id : sent)
+            if (!(got && id == reply.reqid) && parked.erase(id) == 0)
+                abandoned.insert(id);
+        return got && reply.opcode == opcode;
+    }
+
+    bool timedOut = false; // the last next() or wait() gave up waiting
+
+private:
+    uint32_t nextId = 1; // 0 is never used, it marks pushed frames
+
+    static uint64_t newToken()
+    {
+        static thread_local std::mt19937_64 gen(((uint64_t)std::random_device()() << 32) ^ std::random_device()() ^
+                                                (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+        uint64_t t;
+        while ((t = gen()) == 0)
+            ;
+        return t;
+    }
+
+    // wait() for whichever of 'ids' is answered first
+    bool waitAny(const std::vector<uint32_t> &ids, Frame &reply, int timeoutMs)
+    {
+        for (uint32_t id : ids)
+        {
+            auto it = parked.find(id);
+            if (it != parked.end())
+            {
+                reply = std::move(it->second);
+                parked.erase(it);
+                return true;
+            }
+        }
+        while (next(reply, timeoutMs))
+        {
+            if (std::find(ids.begin(), ids.end(), reply.reqid) != ids.end())
+                return true;
+            park(reply);
+        }
+        return false;
+    }
+
+    void park(Frame &f)
+    {
+        if (f.reqid == 0)
+            pushes.push_back(std::move(f));
+        else if (abandoned.erase(f.reqid) == 0)
+            parked[f.reqid] = std::move(f);
+    }
+
+    std::unordered_map<uint32_t, Frame> parked;
+    std::unordered_set<uint32_t> abandoned; // callOnce() copies nobody waits for any more
+    std::deque<Frame> pushes;
+    std::string wbuf, rbuf;
+    size_t rpos = 0;
+};
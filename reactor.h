@@ -0,0 +1,532 @@
+// reactor.h
+#pragma once
+// edge-triggered epoll event loop for the admin server (port 12347)
+// every client socket is non-blocking; bytes are buffered per connection so a
+// slow terminal only ever delays itself, never the rest of the theater
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// a frame encoded once and shared by every connection it is pushed to
+using SharedFrame = std::shared_ptr<const std::string>;
+
+// replies built off the loop: bytes of their own, with shared buffers (the
+// encoded catalog, say) spliced in between; those are written straight from
+// the shared copy, never copied into the connection
+struct Replies
+{
+    std::string bytes;
+    std::vector<std::pair<size_t, SharedFrame>> spliced; // buffer goes after bytes[0, first)
+
+    Replies() = default;
+    Replies(std::string b) : bytes(std::move(b)) {}
+    void splice(SharedFrame f) { spliced.emplace_back(bytes.size(), std::move(f)); }
+};
+
+// how other threads name a connection
+struct Peer
+{
+    int fd;
+    uint64_t id;
+};
+
+class Connection
+{
+public:
+    int fd = -1;
+    uint64_t id = 0;    // fds get reused, ids do not
+    std::string in;     // received but not yet parsed
+    std::string out;    // queued but not yet written
+    size_t outOff = 0;  // how much of 'out' is already on the wire
+    std::deque<std::pair<size_t, SharedFrame>> spliced; // replies written from shared buffers, each after out[0, first)
+    size_t spliceOff = 0; // how much of spliced.front() is already on the wire
+    std::deque<SharedFrame> pushed; // unsolicited frames, written after 'out'
+    size_t pushOff = 0; // how much of pushed.front() is already on the wire
+    bool lagged = false; // pushes were dropped, the lag notice is queued
+    bool closing = false;
+    bool busy = false;  // a batch of this connection's requests is on a worker
+
+    void queue(const void *data, size_t len)
+    {
+        out.append(static_cast<const char *>(data), len);
+    }
+    void queue(Replies &&r)
+    {
+        for (auto &s : r.spliced)
+            spliced.emplace_back(out.size() + s.first, std::move(s.second));
+        out += r.bytes;
+    }
+    size_t pending() const
+    {
+        size_t n = out.size() - outOff;
+        for (auto &s : spliced)
+            n += s.second->size();
+        for (const SharedFrame &f : pushed)
+            n += f->size();
+        return n - pushOff - spliceOff;
+    }
+};
+
+inline bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+class Reactor
+{
+public:
+    // called whenever new bytes arrived (and again when a busy connection is
+    // released); consumes c.in and either appends replies to c.out directly or
+    // marks the connection busy and answers later through complete()
+    using Handler = std::function<void(Connection &)>;
+
+    Reactor(int listenFd, Handler onData) : listenFd(listenFd), onData(onData) {}
+
+    // called right before a connection is dropped
+    void onClose(Handler h) { closed = std::move(h); }
+
+    // queued instead of further pushes to a connection that has more than
+    // maxBacklog of them unwritten; those are dropped, not buffered forever
+    void setLagNotice(std::string frame) { lagNotice = std::make_shared<const std::string>(std::move(frame)); }
+
+    ~Reactor()
+    {
+        for (auto &it : conns)
+            close(it.first);
+        if (epfd != -1)
+            close(epfd);
+        if (wakeFd != -1)
+            close(wakeFd);
+    }
+
+    bool init()
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1)
+        {
+            perror("epoll_create1");
+            return false;
+        }
+        if (!setNonBlocking(listenFd))
+        {
+            perror("fcntl");
+            return false;
+        }
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeFd == -1)
+        {
+            perror("eventfd");
+            return false;
+        }
+        for (int fd : {listenFd, wakeFd})
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.fd = fd;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+            {
+                perror("epoll_ctl");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // thread safe: queues the same frame on every peer still connected
+    void push(std::vector<Peer> to, SharedFrame frame)
+    {
+        {
+            std::lock_guard<std::mutex> lk(doneMutex);
+            pushes.push_back({std::move(to), std::move(frame)});
+        }
+        uint64_t one = 1;
+        ssize_t w = write(wakeFd, &one, sizeof(one));
+        (void)w;
+    }
+
+    // thread safe: hands the replies of a busy connection back to the loop
+    void complete(int fd, uint64_t id, Replies reply)
+    {
+        {
+            std::lock_guard<std::mutex> lk(doneMutex);
+            done.push_back({fd, id, std::move(reply)});
+        }
+        uint64_t one = 1;
+        ssize_t w = write(wakeFd, &one, sizeof(one));
+        (void)w;
+    }
+
+    // thread safe: runs f on the loop thread (e.g. to finish work that came
+    // back from another pool and touches state only the loop owns)
+    void post(std::function<void()> f)
+    {
+        {
+            std::lock_guard<std::mutex> lk(doneMutex);
+            posted.push_back(std::move(f));
+        }
+        uint64_t one = 1;
+        ssize_t w = write(wakeFd, &one, sizeof(one));
+        (void)w;
+    }
+
+    void run()
+    {
+        epoll_event events[maxEvents];
+        while (true)
+        {
+            int n = epoll_wait(epfd, events, maxEvents, -1);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("epoll_wait");
+                return;
+            }
+            for (int i = 0; i < n; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == listenFd)
+                {
+                    acceptAll();
+                    continue;
+                }
+                if (fd == wakeFd)
+                {
+                    drainCompletions();
+                    continue;
+                }
+                auto it = conns.find(fd);
+                if (it == conns.end())
+                    continue;
+                Connection &c = it->second;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    c.closing = true;
+                if (!c.closing && (events[i].events & EPOLLIN))
+                    readAll(c);
+                settle(c);
+            }
+        }
+    }
+
+    size_t connectionCount() const { return conns.size(); }
+
+private:
+    static const int maxEvents = 256;
+    static const size_t maxBacklog = 64; // unwritten pushes per connection
+    static const int maxIov = 64;
+    int listenFd;
+    int epfd = -1;
+    Handler onData, closed;
+    SharedFrame lagNotice;
+    std::unordered_map<int, Connection> conns;
+    uint64_t nextId = 1;
+
+    struct Done
+    {
+        int fd;
+        uint64_t id;
+        Replies reply;
+    };
+    struct Push
+    {
+        std::vector<Peer> to;
+        SharedFrame frame;
+    };
+    int wakeFd = -1;
+    std::mutex doneMutex;
+    std::vector<Done> done;
+    std::vector<Push> pushes;
+    std::vector<std::function<void()>> posted;
+
+    void drainCompletions()
+    {
+        uint64_t cnt;
+        while (read(wakeFd, &cnt, sizeof(cnt)) > 0)
+            ;
+        std::vector<Done> batch;
+        std::vector<Push> fanout;
+        std::vector<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lk(doneMutex);
+            batch.swap(done);
+            fanout.swap(pushes);
+            tasks.swap(posted);
+        }
+        for (auto &f : tasks)
+            f();
+        for (Done &d : batch)
+        {
+            auto it = conns.find(d.fd);
+            if (it == conns.end() || it->second.id != d.id)
+                continue; // the connection went away meanwhile
+            Connection &c = it->second;
+            c.queue(std::move(d.reply));
+            c.busy = false;
+            if (!c.in.empty())
+                onData(c);
+            settle(c);
+        }
+        // queue everything first, then one write per connection
+        std::vector<int> touched;
+        for (Push &p : fanout)
+            for (Peer &to : p.to)
+            {
+                auto it = conns.find(to.fd);
+                if (it == conns.end() || it->second.id != to.id || it->second.closing)
+                    continue;
+                deliver(it->second, p.frame);
+                touched.push_back(to.fd);
+            }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (int fd : touched)
+        {
+            auto it = conns.find(fd);
+            if (it != conns.end())
+                settle(it->second);
+        }
+    }
+
+    // a slow reader does not get an ever growing queue: past maxBacklog its
+    // unwritten pushes are swapped for one lag notice, and nothing more is
+    // queued until that notice is on the wire
+    void deliver(Connection &c, const SharedFrame &frame)
+    {
+        if (c.lagged)
+            return;
+        if (c.pushed.size() < maxBacklog)
+        {
+            c.pushed.push_back(frame);
+            return;
+        }
+        if (!lagNotice)
+            return; // nobody set one, the newest frame is simply lost
+        // the half written front frame has to be finished
+        c.pushed.resize(c.pushOff > 0 ? 1 : 0);
+        c.pushed.push_back(lagNotice);
+        c.lagged = true;
+    }
+
+    // write what is queued and drop the connection once it is finished and
+    // everything it was owed is on the wire; a socket that is full keeps a
+    // closing connection until EPOLLOUT lets the last write through (a write
+    // error empties the queue, so a dead peer does not linger)
+    void settle(Connection &c)
+    {
+        if (c.pending() > 0)
+            flush(c);
+        if (c.closing && !c.busy && c.pending() == 0)
+            drop(c.fd);
+    }
+
+    void acceptAll()
+    {
+        // edge triggered: keep accepting until the backlog is empty
+        while (true)
+        {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    perror("accept");
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = fd;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+            {
+                perror("epoll_ctl");
+                close(fd);
+                continue;
+            }
+            Connection &c = conns[fd];
+            c.fd = fd;
+            c.id = nextId++;
+        }
+    }
+
+    void readAll(Connection &c)
+    {
+        char buffer[16384];
+        bool got = false;
+        while (true)
+        {
+            ssize_t r = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (r > 0)
+            {
+                c.in.append(buffer, r);
+                got = true;
+                continue;
+            }
+            if (r == 0)
+                c.closing = true; // peer closed, still answer what it already sent
+            else if (errno == EINTR)
+                continue;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                c.closing = true;
+            break;
+        }
+        if (got && !c.busy)
+            onData(c);
+    }
+
+    // replies and pushed frames leave in one sendmsg; a frame that is half on
+    // the wire always goes first, so two frames never interleave
+    void flush(Connection &c)
+    {
+        while (c.pending() > 0)
+        {
+            iovec iov[maxIov];
+            int n = 0;
+            size_t p = 0;
+            bool pushFirst = c.pushOff > 0;
+            if (pushFirst)
+            {
+                iov[n++] = {(void *)(c.pushed[0]->data() + c.pushOff), c.pushed[0]->size() - c.pushOff};
+                p = 1;
+            }
+            // pushes only after the last reply byte, or they would cut into it
+            if (!replyIov(c, iov, n))
+                p = c.pushed.size();
+            for (; p < c.pushed.size() && n < maxIov; p++)
+                iov[n++] = {(void *)c.pushed[p]->data(), c.pushed[p]->size()};
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            ssize_t w = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+            if (w > 0)
+            {
+                advance(c, w, pushFirst);
+                continue;
+            }
+            if (w == -1 && errno == EINTR)
+                continue;
+            if (w == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return; // EPOLLOUT will fire once the socket drains
+            c.closing = true;
+            c.out.clear();
+            c.outOff = 0;
+            c.spliced.clear();
+            c.spliceOff = 0;
+            c.pushed.clear();
+            c.pushOff = 0;
+            return;
+        }
+        c.out.clear();
+        c.outOff = 0;
+    }
+
+    // marks w written bytes done, in the order flush() handed them out
+    void advance(Connection &c, size_t w, bool pushFirst)
+    {
+        if (pushFirst)
+            w = advancePush(c, w);
+        w = advanceOut(c, w);
+        while (w > 0)
+            w = advancePush(c, w);
+    }
+
+    // the unwritten replies, own bytes and spliced buffers in order; false
+    // if they did not all fit into iov
+    bool replyIov(Connection &c, iovec *iov, int &n)
+    {
+        size_t pos = c.outOff;
+        for (auto &s : c.spliced)
+        {
+            if (s.first > pos)
+            {
+                if (n == maxIov)
+                    return false;
+                iov[n++] = {(void *)(c.out.data() + pos), s.first - pos};
+                pos = s.first;
+            }
+            if (n == maxIov)
+                return false;
+            size_t off = &s == &c.spliced.front() ? c.spliceOff : 0;
+            iov[n++] = {(void *)(s.second->data() + off), s.second->size() - off};
+        }
+        if (pos < c.out.size())
+        {
+            if (n == maxIov)
+                return false;
+            iov[n++] = {(void *)(c.out.data() + pos), c.out.size() - pos};
+        }
+        return true;
+    }
+
+    // marks up to w reply bytes written; returns what is left for the pushes
+    size_t advanceOut(Connection &c, size_t w)
+    {
+        while (w > 0)
+        {
+            if (!c.spliced.empty() && c.outOff == c.spliced.front().first)
+            {
+                const SharedFrame &f = c.spliced.front().second;
+                size_t k = std::min(w, f->size() - c.spliceOff);
+                c.spliceOff += k;
+                w -= k;
+                if (c.spliceOff == f->size())
+                {
+                    c.spliced.pop_front();
+                    c.spliceOff = 0;
+                }
+                continue;
+            }
+            size_t end = c.spliced.empty() ? c.out.size() : c.spliced.front().first;
+            if (c.outOff == end)
+                break;
+            size_t k = std::min(w, end - c.outOff);
+            c.outOff += k;
+            w -= k;
+        }
+        if (c.spliced.empty() && c.outOff == c.out.size())
+        {
+            c.out.clear();
+            c.outOff = 0;
+        }
+        return w;
+    }
+
+    size_t advancePush(Connection &c, size_t w)
+    {
+        const SharedFrame &f = c.pushed.front();
+        size_t k = std::min(w, f->size() - c.pushOff);
+        c.pushOff += k;
+        if (c.pushOff == f->size())
+        {
+            if (f == lagNotice)
+                c.lagged = false;
+            c.pushed.pop_front();
+            c.pushOff = 0;
+        }
+        return w - k;
+    }
+
+    void drop(int fd)
+    {
+        auto it = conns.find(fd);
+        if (it != conns.end() && closed)
+            closed(it->second);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        conns.erase(fd);
+    }
+};
@@ -0,0 +1,171 @@
+// seatbitset.h
+#pragma once
+// seat inventory of one hall packed into 64 bit words, bit (row*cols+col) set = seat taken
+// the default 9x9 hall is 81 bits = 2 words; bigger venues simply get more words
+// booking a group is a compare-and-swap per affected word, no mutex anywhere
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+class SeatMap
+{
+public:
+    SeatMap(int rows, int cols) : rows(rows), cols(cols), nwords(wordsFor(rows, cols))
+    {
+        owned.reset(new std::atomic<uint64_t>[nwords]);
+        words = owned.get();
+        clear();
+    }
+
+    // storage provided by the caller (must hold wordsFor(rows, cols) words)
+    SeatMap(int rows, int cols, std::atomic<uint64_t> *storage)
+        : rows(rows), cols(cols), nwords(wordsFor(rows, cols)), words(storage)
+    {
+        clear();
+    }
+
+    SeatMap(const SeatMap &) = delete;
+    SeatMap &operator=(const SeatMap &) = delete;
+
+    static size_t wordsFor(int rows, int cols) { return ((size_t)rows * cols + 63) / 64; }
+
+    int rowCount() const { return rows; }
+    int colCount() const { return cols; }
+    size_t wordCount() const { return nwords; }
+
+    bool valid(int r, int c) const { return r >= 0 && r < rows && c >= 0 && c < cols; }
+    int bit(int r, int c) const { return r * cols + c; }
+
+    bool taken(int r, int c) const
+    {
+        int b = bit(r, c);
+        return (words[b / 64].load(std::memory_order_acquire) >> (b % 64)) & 1;
+    }
+
+    // takes every seat of the group or none of them. Returns the conflicts:
+    // bit i set = bits[i] was already taken (or repeats an earlier seat of the
+    // group), 0 = the whole group is now booked
+    uint64_t book(const std::vector<int> &bits)
+    {
+        uint64_t conflicts = duplicates(bits);
+        if (conflicts)
+            return conflicts;
+        std::vector<std::pair<size_t, uint64_t>> masks = group(bits);
+        for (size_t k = 0; k < masks.size(); k++)
+        {
+            std::atomic<uint64_t> &w = words[masks[k].first];
+            uint64_t old = w.load(std::memory_order_relaxed);
+            do
+            {
+                if (old & masks[k].second)
+                {
+                    // lost the race for this word, hand back what we already took
+                    for (size_t j = 0; j < k; j++)
+                        words[masks[j].first].fetch_and(~masks[j].second, std::memory_order_release);
+                    return conflictsOf(bits, masks[k].first, old);
+                }
+            } while (!w.compare_exchange_weak(old, old | masks[k].second, std::memory_order_acq_rel, std::memory_order_relaxed));
+        }
+        return 0;
+    }
+
+    // marks the seats taken whatever they were, e.g. when replaying a log
+    void take(const std::vector<int> &bits)
+    {
+        for (auto &m : group(bits))
+            words[m.first].fetch_or(m.second, std::memory_order_release);
+    }
+
+    void release(const std::vector<int> &bits)
+    {
+        for (auto &m : group(bits))
+            words[m.first].fetch_and(~m.second, std::memory_order_release);
+    }
+
+    // copies the raw words (wordCount() of them) e.g. to send them to a client
+    void snapshot(uint64_t *out) const
+    {
+        for (size_t i = 0; i < nwords; i++)
+            out[i] = words[i].load(std::memory_order_acquire);
+    }
+
+    // seats taken right now
+    int takenCount() const
+    {
+        int n = 0;
+        for (size_t i = 0; i < nwords; i++)
+            n += __builtin_popcountll(words[i].load(std::memory_order_relaxed));
+        return n;
+    }
+
+    // overwrites the raw words, e.g. from a snapshot
+    void load(const uint64_t *in)
+    {
+        for (size_t i = 0; i < nwords; i++)
+            words[i].store(in[i], std::memory_order_release);
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < nwords; i++)
+            words[i].store(0, std::memory_order_relaxed);
+    }
+
+private:
+    int rows, cols;
+    size_t nwords;
+    std::atomic<uint64_t> *words;
+    std::unique_ptr<std::atomic<uint64_t>[]> owned;
+
+    uint64_t duplicates(const std::vector<int> &bits) const
+    {
+        uint64_t dup = 0;
+        for (size_t i = 0; i < bits.size(); i++)
+            for (size_t j = 0; j < i; j++)
+                if (bits[i] == bits[j])
+                    dup |= 1ULL << i;
+        return dup;
+    }
+
+    // which seats of the group are taken after a failed book; the word we lost
+    // on is judged by the value we saw, the others are read again
+    uint64_t conflictsOf(const std::vector<int> &bits, size_t lostWord, uint64_t lostOld) const
+    {
+        uint64_t conflicts = 0;
+        for (size_t i = 0; i < bits.size(); i++)
+        {
+            size_t wi = bits[i] / 64;
+            uint64_t w = (wi == lostWord) ? lostOld : words[wi].load(std::memory_order_acquire);
+            if ((w >> (bits[i] % 64)) & 1)
+                conflicts |= 1ULL << i;
+        }
+        return conflicts;
+    }
+
+    // (word index, bits in that word) in ascending word order, so two groups
+    // that overlap always meet on the same word first
+    std::vector<std::pair<size_t, uint64_t>> group(const std::vector<int> &bits) const
+    {
+        std::vector<std::pair<size_t, uint64_t>> masks;
+        for (int b : bits)
+        {
+            size_t wi = b / 64;
+            size_t k = 0;
+            while (k < masks.size() && masks[k].first < wi)
+                k++;
+            if (k == masks.size() || masks[k].first != wi)
+                masks.insert(masks.begin() + k, {wi, 0});
+            masks[k].second |= 1ULL << (b % 64);
+        }
+        return masks;
+    }
+};
+
+// client side: turns the words of a snapshot back into the seat grid
+inline bool seatTaken(const uint64_t *words, int cols, int r, int c)
+{
+    int b = r * cols + c;
+    return (words[b / 64] >> (b % 64)) & 1;
+}
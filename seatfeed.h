@@ -0,0 +1,90 @@
+// seatfeed.h
+#pragma once
+// which connections subscribed to which show's seat changes. Every booking
+// looks its show up here, so lookups share the lock and only (un)subscribing
+// and closing connections take it exclusively
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "protocol.h"
+#include "reactor.h"
+#include "showinventory.h"
+
+class SeatFeed
+{
+public:
+    void subscribe(const ShowKey &k, Peer p)
+    {
+        std::unique_lock<std::shared_mutex> lk(m);
+        std::vector<Peer> &subs = byShow[k];
+        for (const Peer &s : subs)
+            if (s.id == p.id)
+                return;
+        subs.push_back(p);
+        byPeer[p.id].push_back(k);
+    }
+
+    // false if p was not subscribed to the show
+    bool unsubscribe(const ShowKey &k, Peer p)
+    {
+        std::unique_lock<std::shared_mutex> lk(m);
+        if (!removeFrom(k, p.id))
+            return false;
+        std::vector<ShowKey> &keys = byPeer[p.id];
+        keys.erase(std::find(keys.begin(), keys.end(), k));
+        if (keys.empty())
+            byPeer.erase(p.id);
+        return true;
+    }
+
+    // the connection is gone: forget everything it subscribed to
+    void drop(uint64_t peerId)
+    {
+        std::unique_lock<std::shared_mutex> lk(m);
+        auto it = byPeer.find(peerId);
+        if (it == byPeer.end())
+            return;
+        for (const ShowKey &k : it->second)
+            removeFrom(k, peerId);
+        byPeer.erase(it);
+    }
+
+    std::vector<Peer> subscribers(const ShowKey &k)
+    {
+        std::shared_lock<std::shared_mutex> lk(m);
+        auto it = byShow.find(k);
+        return it == byShow.end() ? std::vector<Peer>() : it->second;
+    }
+
+    size_t connectionCount()
+    {
+        std::shared_lock<std::shared_mutex> lk(m);
+        return byPeer.size();
+    }
+
+private:
+    std::shared_mutex m;
+    std::unordered_map<ShowKey, std::vector<Peer>, ShowKeyHash> byShow;
+    std::unordered_map<uint64_t, std::vector<ShowKey>> byPeer;
+
+    bool removeFrom(const ShowKey &k, uint64_t peerId)
+    {
+        auto it = byShow.find(k);
+        if (it == byShow.end())
+            return false;
+        std::vector<Peer> &subs = it->second;
+        for (size_t i = 0; i < subs.size(); i++)
+            if (subs[i].id == peerId)
+            {
+                subs[i] = subs.back();
+                subs.pop_back();
+                if (subs.empty())
+                    byShow.erase(it);
+                return true;
+            }
+        return false;
+    }
+};
@@ -0,0 +1,109 @@
+// seatfinder.h
+#pragma once
+// best available seats: n adjacent free seats inside one tier of a venue,
+// never spanning an aisle. Works on the packed SeatMap words 64 columns at a
+// time, so a row costs a handful of shifts and ands no matter the venue size
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+struct Venue
+{
+    int rows, cols;
+    std::vector<int> aisles;               // an aisle runs right after each of these columns
+    std::vector<std::pair<int, int>> tiers; // first and last row of every tier, front to back
+};
+
+// the 9x9 hall client.cpp draws: aisles after columns 1 and 6,
+// PREMIUM rows 0-2, BUSINESS rows 3-6, ECONOMY rows 7-8
+inline Venue defaultHall()
+{
+    return {9, 9, {1, 6}, {{0, 2}, {3, 6}, {7, 8}}};
+}
+
+class SeatFinder
+{
+public:
+    static const int maxGroup = 10; // a booking carries at most 10 seats
+
+    explicit SeatFinder(const Venue &v) : venue(v), aisleBits((v.cols + 63) / 64 + 1, 0)
+    {
+        for (int c : v.aisles)
+            if (c >= 0 && c < v.cols)
+                aisleBits[c / 64] |= 1ULL << (c % 64);
+    }
+
+    const Venue &layout() const { return venue; }
+
+    // picks n adjacent free seats in 'tier' from a snapshot of the show's words
+    // (bit row*cols+col set = taken). Rows nearest the middle of the tier win,
+    // inside a row the run nearest the centre. Fills (row, col) pairs.
+    bool find(const uint64_t *words, int tier, int n, std::vector<std::pair<int, int>> &seats) const
+    {
+        seats.clear();
+        if (tier < 0 || tier >= (int)venue.tiers.size() || n < 1 || n > maxGroup || n > venue.cols)
+            return false;
+        int first = venue.tiers[tier].first, last = venue.tiers[tier].second;
+        int mid = (first + last) / 2;
+        for (int d = 0; d < 2 * (last - first + 1); d++)
+        {
+            // mid, mid+1, mid-1, mid+2, mid-2 ...
+            int r = (d % 2) ? mid + (d + 1) / 2 : mid - d / 2;
+            if (r < first || r > last)
+                continue;
+            int c = bestInRow(words, r, n);
+            if (c >= 0)
+            {
+                for (int k = 0; k < n; k++)
+                    seats.push_back({r, c + k});
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    Venue venue;
+    std::vector<uint64_t> aisleBits; // bit c set = aisle between column c and c+1
+
+    // len (<= 64) bits starting at bit pos
+    static uint64_t bitsAt(const uint64_t *w, size_t pos, int len)
+    {
+        uint64_t v = w[pos / 64] >> (pos % 64);
+        if (pos % 64 != 0 && pos % 64 + len > 64)
+            v |= w[pos / 64 + 1] << (64 - pos % 64);
+        return len == 64 ? v : v & ((1ULL << len) - 1);
+    }
+
+    // start column of the run of n free seats closest to the row centre, -1 if none
+    int bestInRow(const uint64_t *words, int r, int n) const
+    {
+        int cols = venue.cols;
+        int centre = (cols - n) / 2;
+        int best = -1;
+        // windows of 64 columns overlapping by n-1, so no run is cut in two
+        for (int w0 = 0; w0 + n <= cols; w0 += 64 - (n - 1))
+        {
+            int len = std::min(64, cols - w0);
+            uint64_t mask = len == 64 ? ~0ULL : (1ULL << len) - 1;
+            uint64_t freeBits = ~bitsAt(words, (size_t)r * cols + w0, len) & mask;
+            uint64_t breaks = bitsAt(aisleBits.data(), w0, len);
+            // bit j of 'run' = columns w0+j .. w0+j+k are free with no aisle between them
+            uint64_t run = freeBits;
+            for (int k = 1; k < n && run; k++)
+                run &= (freeBits >> k) & ~(breaks >> (k - 1));
+            while (run)
+            {
+                int c = w0 + __builtin_ctzll(run);
+                if (best < 0 || std::abs(c - centre) < std::abs(best - centre))
+                    best = c;
+                run &= run - 1;
+            }
+            if (w0 + len >= cols)
+                break;
+        }
+        return best;
+    }
+};
@@ -1,5 +1,8 @@
 #include<iostream>
 #include<bits/stdc++.h>
+#include "seatbitset.h"
+#include "seatfinder.h"
+#include "seatstore.h"
 using namespace std;
 
 void stadium(){
@@ -16,35 +19,60 @@ void stadium(){
         cout<<"\n";
     }
 }
-void moviehall(){
-  unordered_map<int,int>m;
-  ifstream infile("seat.txt");
-    if (infile.is_open()) {
-        while (infile) {
-            char r,c;
-            infile >>r>>c;
-            if (infile) {
-                m[(r-48)*10+(c-48)]++;
+// draws a hall: free seats by number (row digit, column digit), taken ones as
+// " * ", a gap at every aisle and a banner where each tier starts
+template <typename F>
+void drawhall(const Venue &v,F taken){
+    static const char *banner[]={"-------------PREMIUM------------------",
+                                 "-------------BUSINESS------------------",
+                                 "-------------ECONOMY-------------------"};
+    cout<<"--------------Screen-------------------\n\n";
+    for(int i=0;i<v.rows;i++){
+        for(size_t t=0;t<v.tiers.size();t++)
+            if(v.tiers[t].first==i){
+                if(t<3)cout<<banner[t];
+                else cout<<"-------------TIER "<<t+1<<"---------------------";
+                cout<<"\n";
             }
-        }
-        infile.close();
-    } 
-    else cerr << "Unable to open the seat file for reading." << endl;
-    
-    for(int i=0;i<9;i++){
-            for(int j=0;j<9;j++)
-            {
-                if(m[i*10+j]==0){
-                cout<<i<<j<<" ";
-                }
-                else{
-                    cout<<" * ";
-                }
-                if(j==1||j==6)cout<<"   ";
+        for(int j=0;j<v.cols;j++)
+        {
+            if(!taken(i,j)){
+            cout<<i<<j<<" ";
+            }
+            else{
+                cout<<" * ";
             }
-            cout<<"\n";
-            if(i==2||i==6)cout<<"\n";
+            if(find(v.aisles.begin(),v.aisles.end(),j)!=v.aisles.end())cout<<"   ";
         }
-
+        cout<<"\n";
+    }
+    cout<<"\n";
+}
+// the layout to draw a rows x cols hall with: the default hall's aisles and
+// tiers if it is that size, none otherwise
+Venue halllayout(int rows,int cols){
+    Venue v=defaultHall();
+    if(v.rows!=rows||v.cols!=cols)
+        v=Venue{rows,cols,{},{}};
+    return v;
+}
+// draws a show straight from the seat file the admin server keeps (seats.bin,
+// seatstore.h): the file is mapped, the grid sized from its header and the
+// show's words copied out of its slot, nothing is parsed. False if the file
+// cannot be mapped, the slot does not check out or its seats are older than
+// version 'atleast' (a file some other server left behind)
+bool moviehall(const char *path,const ShowKey &show,uint64_t atleast=0){
+    SeatStore store;
+    if(!store.openReadOnly(path))
+        return false;
+    vector<uint64_t> words(store.wordsPerShow(),0);
+    uint64_t version=0;
+    // a show nobody booked or looked at yet has no slot: every seat is free
+    if(store.find(show)!=nullptr&&!store.read(show,words.data(),&version))
+        return false;
+    if(version<atleast)
+        return false;
+    int cols=store.colCount();
+    drawhall(halllayout(store.rowCount(),cols),[&](int r,int c){ return seatTaken(words.data(),cols,r,c); });
+    return true;
 }
-
@@ -0,0 +1,350 @@
+// seatstore.h
+#pragma once
+// seat file shared between processes (seats.bin): a header, then one fixed
+// size slot per show holding its key and its seat words, so any process that
+// maps the file finds a show by hashing its key and reads the words in place.
+// The admin server books straight into the mapped words (they are the
+// SeatMap storage); readers use the slot's sequence number to get a copy no
+// booking tore apart, and the checksum to notice a damaged file
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "protocol.h"
+
+struct SeatFileHeader
+{
+    char magic[4];           // "SEAT"
+    uint32_t format;
+    uint32_t rows, cols;
+    uint32_t wordsPerShow;
+    uint32_t capacity;       // slots
+    uint32_t slotBytes;
+    uint32_t checksum;       // of the fields above
+    std::atomic<uint32_t> shows; // slots in use
+    char pad[28];
+};
+static_assert(sizeof(SeatFileHeader) == 64, "seat file header is one cache line");
+
+struct SeatSlot
+{
+    std::atomic<uint32_t> state;   // 0 free, 1 being claimed, 2 in use
+    int32_t movie, date, slot;     // the show
+    uint32_t nwords;
+    uint32_t pad;
+    std::atomic<uint64_t> seq;     // writers in the low 32 bits, finished writes above
+    std::atomic<uint64_t> version; // the show's ChangeLog version
+    std::atomic<uint64_t> checksum; // of key, version and words while no writer is in
+    // nwords std::atomic<uint64_t> follow
+
+    std::atomic<uint64_t> *words() { return reinterpret_cast<std::atomic<uint64_t> *>(this + 1); }
+    const std::atomic<uint64_t> *words() const { return reinterpret_cast<const std::atomic<uint64_t> *>(this + 1); }
+};
+static_assert(sizeof(SeatSlot) == 48, "seat words start 48 bytes into a slot");
+
+class SeatStore
+{
+public:
+    static const uint32_t format = 2; // 2: several writers per slot at once
+
+    SeatStore() = default;
+    SeatStore(const SeatStore &) = delete;
+    SeatStore &operator=(const SeatStore &) = delete;
+    ~SeatStore()
+    {
+        if (base != nullptr)
+            munmap(base, length);
+    }
+
+    // admin server: opens the file for rows x cols halls with room for
+    // 'capacity' shows, every slot empty. A file laid out the same way is
+    // kept and only its used slots are cleared (recovery puts the seats back);
+    // any other is replaced by a fresh one renamed over it, so a process that
+    // still maps the old file never sees it shrink under it
+    bool create(const std::string &path, int rows, int cols, uint32_t capacity)
+    {
+        uint32_t nwords = ((size_t)rows * cols + 63) / 64;
+        uint32_t slotBytes = (sizeof(SeatSlot) + nwords * 8 + 63) / 64 * 64;
+        size_t len = sizeof(SeatFileHeader) + (size_t)capacity * slotBytes;
+        SeatFileHeader want = {};
+        want.format = format;
+        want.rows = rows;
+        want.cols = cols;
+        want.wordsPerShow = nwords;
+        want.capacity = capacity;
+        want.slotBytes = slotBytes;
+        want.checksum = headerSum(want);
+
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (fd != -1 && (fstat(fd, &st) == -1 || (size_t)st.st_size != len))
+        {
+            close(fd);
+            fd = -1;
+        }
+        if (fd != -1 && map(fd, len, PROT_READ | PROT_WRITE))
+        {
+            const SeatFileHeader *h = header();
+            if (memcmp(h->magic, "SEAT", 4) == 0 && h->format == format && h->rows == want.rows &&
+                h->cols == want.cols && h->wordsPerShow == nwords && h->capacity == capacity &&
+                h->slotBytes == slotBytes && h->checksum == want.checksum)
+            {
+                clear();
+                return true;
+            }
+            munmap(base, length);
+            base = nullptr;
+        }
+
+        std::string tmp = path + ".tmp";
+        fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1 || ftruncate(fd, len) == -1)
+        {
+            perror("seat store");
+            if (fd != -1)
+                close(fd);
+            return false;
+        }
+        if (!map(fd, len, PROT_READ | PROT_WRITE))
+            return false;
+        SeatFileHeader *h = header();
+        h->format = format;
+        h->rows = rows;
+        h->cols = cols;
+        h->wordsPerShow = nwords;
+        h->capacity = capacity;
+        h->slotBytes = slotBytes;
+        h->checksum = want.checksum;
+        memcpy(h->magic, "SEAT", 4); // last: a reader never sees a half written header as valid
+        if (rename(tmp.c_str(), path.c_str()) == -1)
+        {
+            perror("seat store");
+            munmap(base, length);
+            base = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    // renderer: maps an existing file read only; false if there is none or
+    // its header does not check out
+    bool openReadOnly(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SeatFileHeader) || !map(fd, st.st_size, PROT_READ))
+        {
+            close(fd);
+            return false;
+        }
+        const SeatFileHeader *h = header();
+        if (memcmp(h->magic, "SEAT", 4) != 0 || h->format != format || h->checksum != headerSum(*h) ||
+            sizeof(SeatFileHeader) + (size_t)h->capacity * h->slotBytes > length)
+        {
+            munmap(base, length);
+            base = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    bool mapped() const { return base != nullptr; }
+    int rowCount() const { return header()->rows; }
+    int colCount() const { return header()->cols; }
+    size_t wordsPerShow() const { return header()->wordsPerShow; }
+    size_t showCount() const { return header()->shows.load(std::memory_order_relaxed); }
+
+    // admin server: the show's slot, taken now if it has none yet; nullptr
+    // when the file is full. Safe against other claimers, in any process
+    SeatSlot *claim(const ShowKey &k)
+    {
+        SeatFileHeader *h = header();
+        uint32_t cap = h->capacity;
+        for (uint32_t i = 0, at = home(k); i < cap; i++, at = (at + 1) % cap)
+        {
+            SeatSlot *s = slotAt(at);
+            uint32_t st = s->state.load(std::memory_order_acquire);
+            if (st == 0)
+            {
+                if (!s->state.compare_exchange_strong(st, 1, std::memory_order_acq_rel))
+                    st = s->state.load(std::memory_order_acquire);
+                else
+                {
+                    s->movie = k.movie;
+                    s->date = k.date;
+                    s->slot = k.slot;
+                    s->nwords = h->wordsPerShow;
+                    s->checksum.store(sum(s), std::memory_order_relaxed);
+                    s->state.store(2, std::memory_order_release);
+                    h->shows.fetch_add(1, std::memory_order_relaxed);
+                    return s;
+                }
+            }
+            while (st == 1)
+                st = s->state.load(std::memory_order_acquire);
+            if (isKey(s, k))
+                return s;
+        }
+        return nullptr;
+    }
+
+    // nullptr if the show has no slot (nobody booked or looked at it yet)
+    const SeatSlot *find(const ShowKey &k) const
+    {
+        uint32_t cap = header()->capacity;
+        for (uint32_t i = 0, at = home(k); i < cap; i++, at = (at + 1) % cap)
+        {
+            const SeatSlot *s = slotAt(at);
+            uint32_t st = s->state.load(std::memory_order_acquire);
+            if (st == 0)
+                return nullptr;
+            if (st == 2 && isKey(s, k))
+                return s;
+        }
+        return nullptr;
+    }
+
+    // copies the show's words (wordsPerShow() of them) as of one moment;
+    // false if the show is not in the file or its slot does not check out
+    bool read(const ShowKey &k, uint64_t *out, uint64_t *version = nullptr) const
+    {
+        const SeatSlot *s = find(k);
+        if (s == nullptr)
+            return false;
+        for (int attempt = 0; attempt < 1000; attempt++)
+        {
+            uint64_t before = s->seq.load(std::memory_order_acquire);
+            if ((uint32_t)before != 0)
+                continue;
+            for (uint32_t i = 0; i < s->nwords; i++)
+                out[i] = s->words()[i].load(std::memory_order_relaxed);
+            uint64_t v = s->version.load(std::memory_order_relaxed);
+            uint64_t c = s->checksum.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->seq.load(std::memory_order_relaxed) != before)
+                continue;
+            if (version != nullptr)
+                *version = v;
+            return c == sum(s->movie, s->date, s->slot, v, out, s->nwords);
+        }
+        return false;
+    }
+
+    // a writer brackets every change of a slot's words; any number of them
+    // may be in at once (bookings of one show do not wait for each other).
+    // The slot keeps the newest version it was told, and the last writer out
+    // leaves the checksum: with nobody else in, the words hold still while it
+    // sums them. A null slot (show not in the file) is ignored
+    static void beginWrite(SeatSlot *s)
+    {
+        if (s == nullptr)
+            return;
+        s->seq.fetch_add(1, std::memory_order_acq_rel);
+    }
+    static void endWrite(SeatSlot *s, uint64_t version)
+    {
+        if (s == nullptr)
+            return;
+        uint64_t v = s->version.load(std::memory_order_relaxed);
+        while (v < version && !s->version.compare_exchange_weak(v, version, std::memory_order_relaxed))
+            ;
+        uint64_t seq = s->seq.load(std::memory_order_acquire);
+        do
+        {
+            if ((uint32_t)seq == 1)
+                s->checksum.store(sum(s), std::memory_order_relaxed);
+        } while (!s->seq.compare_exchange_weak(seq, seq + (1ULL << 32) - 1, std::memory_order_acq_rel,
+                                               std::memory_order_acquire));
+    }
+    static uint64_t versionOf(const SeatSlot *s) { return s == nullptr ? 0 : s->version.load(std::memory_order_relaxed); }
+
+private:
+    void *base = nullptr;
+    size_t length = 0;
+
+    // empties every used slot of a kept file: freed first, so a reader
+    // looking for the show finds nothing (all seats free) rather than seats
+    // the last run may never have logged
+    void clear()
+    {
+        SeatFileHeader *h = header();
+        for (uint32_t i = 0; i < h->capacity; i++)
+        {
+            SeatSlot *s = slotAt(i);
+            if (s->state.load(std::memory_order_relaxed) == 0)
+                continue;
+            s->state.store(0, std::memory_order_release);
+            s->seq.store(0, std::memory_order_relaxed);
+            s->version.store(0, std::memory_order_relaxed);
+            for (uint32_t w = 0; w < h->wordsPerShow; w++)
+                s->words()[w].store(0, std::memory_order_relaxed);
+        }
+        h->shows.store(0, std::memory_order_relaxed);
+    }
+
+    bool map(int fd, size_t len, int prot)
+    {
+        void *p = mmap(nullptr, len, prot, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            perror("seat store mmap");
+            return false;
+        }
+        base = p;
+        length = len;
+        return true;
+    }
+
+    SeatFileHeader *header() const { return static_cast<SeatFileHeader *>(base); }
+    SeatSlot *slotAt(uint32_t i) const
+    {
+        return reinterpret_cast<SeatSlot *>(static_cast<char *>(base) + sizeof(SeatFileHeader) + (size_t)i * header()->slotBytes);
+    }
+
+    uint32_t home(const ShowKey &k) const
+    {
+        uint64_t h = (uint64_t)(uint32_t)k.movie * 0x9E3779B97F4A7C15ULL;
+        h ^= ((uint64_t)(uint32_t)k.date << 8 | (uint32_t)k.slot) * 0xC2B2AE3D27D4EB4FULL;
+        return (h ^ (h >> 29)) % header()->capacity;
+    }
+
+    static bool isKey(const SeatSlot *s, const ShowKey &k)
+    {
+        return s->movie == k.movie && s->date == k.date && s->slot == k.slot;
+    }
+
+    static uint64_t mix(uint64_t h, uint64_t v) { return (h ^ v) * 0x100000001B3ULL + (h >> 29); }
+
+    static uint64_t sum(int32_t movie, int32_t date, int32_t slot, uint64_t version, const uint64_t *w, uint32_t n)
+    {
+        uint64_t h = mix(mix(mix(mix(0xCBF29CE484222325ULL, (uint32_t)movie), (uint32_t)date), (uint32_t)slot), version);
+        for (uint32_t i = 0; i < n; i++)
+            h = mix(h, w[i]);
+        return h;
+    }
+    static uint64_t sum(const SeatSlot *s)
+    {
+        uint64_t h = mix(mix(mix(mix(0xCBF29CE484222325ULL, (uint32_t)s->movie), (uint32_t)s->date), (uint32_t)s->slot),
+                         s->version.load(std::memory_order_relaxed));
+        for (uint32_t i = 0; i < s->nwords; i++)
+            h = mix(h, s->words()[i].load(std::memory_order_relaxed));
+        return h;
+    }
+
+    static uint32_t headerSum(const SeatFileHeader &h)
+    {
+        uint32_t f[] = {h.format, h.rows, h.cols, h.wordsPerShow, h.capacity, h.slotBytes};
+        uint32_t c = 2166136261u;
+        for (uint32_t v : f)
+            c = (c ^ v) * 16777619u;
+        return c;
+    }
+};
@@ -0,0 +1,233 @@
+// showinventory.h
+#pragma once
+// seat maps of every show, keyed by (movie, date, time slot)
+// a show's map is created the first time somebody looks at it; its words live
+// in the shared seat file when one is attached (other processes read them
+// there), else in slabs preallocated per shard, so creating a show is a bump
+// of an index.
+// Shows hash to independent shards, bookings of different shows never meet
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "seatbitset.h"
+#include "changelog.h"
+#include "seatstore.h"
+#include "protocol.h"
+#include "pricing.h"
+
+struct ShowKeyHash
+{
+    size_t operator()(const ShowKey &k) const
+    {
+        uint64_t h = (uint64_t)(uint32_t)k.movie * 0x9E3779B97F4A7C15ULL;
+        h ^= ((uint64_t)(uint32_t)k.date << 8 | (uint32_t)k.slot) * 0xC2B2AE3D27D4EB4FULL;
+        return h ^ (h >> 29);
+    }
+};
+
+struct Show;
+
+// told about every logged seat change (show, new version, seat bits, taken)
+// right after it; changes of one show can be told concurrently and out of
+// version order
+using ChangeHook = std::function<void(Show &, uint64_t, const std::vector<int> &, bool)>;
+
+// one show: its seats plus the log of what changed on them, and its prices
+struct Show
+{
+    const ShowKey key;
+    PriceCard price; // see pricing.h
+    SeatMap seats;
+    ChangeLog changes;
+    const ChangeHook *hook;
+    SeatSlot *slot; // where the words live in the seat file, nullptr if not there
+
+    Show(const ShowKey &key, int rows, int cols, std::atomic<uint64_t> *words, const ChangeHook *hook, SeatSlot *slot)
+        : key(key), seats(rows, cols, words), hook(hook), slot(slot) {}
+
+    // SeatMap::book() / release() that also log the change
+    uint64_t book(const std::vector<int> &bits)
+    {
+        uint64_t lost = 0;
+        auto cas = [&]()
+        {
+            SeatStore::beginWrite(slot);
+            lost = seats.book(bits);
+            if (lost != 0)
+                SeatStore::endWrite(slot, SeatStore::versionOf(slot));
+            return lost == 0;
+        };
+        changes.record(bits, true, cas, [&](uint64_t v) { changed(v, bits, true); });
+        return lost;
+    }
+    void release(const std::vector<int> &bits)
+    {
+        auto clear = [&]()
+        {
+            SeatStore::beginWrite(slot);
+            seats.release(bits);
+            return true;
+        };
+        changes.record(bits, false, clear, [&](uint64_t v) { changed(v, bits, false); });
+    }
+
+    // recovery: sets the seats as a log says they were at 'version', nobody
+    // is told. Records come in any order, a seat only takes a state newer
+    // than the one it has
+    void restore(const std::vector<int> &bits, bool taken, uint64_t version)
+    {
+        if (restored.empty())
+            restored.assign((size_t)seats.rowCount() * seats.colCount(), 0);
+        std::vector<int> newer;
+        for (int b : bits)
+            if (b >= 0 && (size_t)b < restored.size() && version > restored[b])
+            {
+                restored[b] = version;
+                newer.push_back(b);
+            }
+        SeatStore::beginWrite(slot);
+        if (taken)
+            seats.take(newer);
+        else
+            seats.release(newer);
+        changes.restore(version);
+        SeatStore::endWrite(slot, version);
+    }
+    void restore(const uint64_t *words, uint64_t version)
+    {
+        restored.assign((size_t)seats.rowCount() * seats.colCount(), version);
+        SeatStore::beginWrite(slot);
+        seats.load(words);
+        changes.restore(version);
+        SeatStore::endWrite(slot, version);
+    }
+    // recovery is over, the seat versions it needed go
+    void recovered() { std::vector<uint64_t>().swap(restored); }
+
+private:
+    std::vector<uint64_t> restored; // recovery only: the version each seat was last set at
+
+    void changed(uint64_t version, const std::vector<int> &bits, bool taken)
+    {
+        SeatStore::endWrite(slot, version);
+        if (*hook)
+            (*hook)(*this, version, bits, taken);
+    }
+};
+
+class ShowInventory
+{
+public:
+    ShowInventory(int rows, int cols, size_t nshards = 64, size_t slabShows = 64)
+        : rows(rows), cols(cols), wordsPerShow(SeatMap::wordsFor(rows, cols)), slabShows(slabShows)
+    {
+        for (size_t i = 0; i < nshards; i++)
+        {
+            shards.emplace_back(new Shard);
+            addSlab(*shards.back());
+        }
+    }
+
+    ShowInventory(const ShowInventory &) = delete;
+    ShowInventory &operator=(const ShowInventory &) = delete;
+
+    int rowCount() const { return rows; }
+    int colCount() const { return cols; }
+
+    // set once before the first show is touched
+    void onChange(ChangeHook h) { hook = std::move(h); }
+    void attach(SeatStore *s) { store = s; }
+
+    // the show, created (all seats free) on first use
+    Show &get(const ShowKey &k)
+    {
+        Shard &s = shardOf(k);
+        {
+            std::shared_lock<std::shared_mutex> lk(s.m);
+            auto it = s.index.find(k);
+            if (it != s.index.end())
+                return *it->second;
+        }
+        std::unique_lock<std::shared_mutex> lk(s.m);
+        auto it = s.index.find(k);
+        if (it != s.index.end())
+            return *it->second;
+        SeatSlot *slot = store != nullptr ? store->claim(k) : nullptr;
+        std::atomic<uint64_t> *words;
+        if (slot != nullptr)
+            words = slot->words();
+        else
+        {
+            // no seat file, or it is full: only this process sees the show
+            if (s.used == slabShows)
+                addSlab(s);
+            words = s.slabs.back().get() + s.used * wordsPerShow;
+            s.used++;
+        }
+        s.maps.emplace_back(k, rows, cols, words, &hook, slot);
+        s.index[k] = &s.maps.back();
+        return s.maps.back();
+    }
+
+    // nullptr if nobody touched the show yet
+    Show *find(const ShowKey &k)
+    {
+        Shard &s = shardOf(k);
+        std::shared_lock<std::shared_mutex> lk(s.m);
+        auto it = s.index.find(k);
+        return it == s.index.end() ? nullptr : it->second;
+    }
+
+    // f(Show &) for every show created so far, each shard read locked in turn
+    template <typename F>
+    void forEach(F f)
+    {
+        for (auto &s : shards)
+        {
+            std::shared_lock<std::shared_mutex> lk(s->m);
+            for (Show &show : s->maps)
+                f(show);
+        }
+    }
+
+    size_t showCount()
+    {
+        size_t n = 0;
+        for (auto &s : shards)
+        {
+            std::shared_lock<std::shared_mutex> lk(s->m);
+            n += s->index.size();
+        }
+        return n;
+    }
+
+private:
+    struct Shard
+    {
+        std::shared_mutex m;
+        std::unordered_map<ShowKey, Show *, ShowKeyHash> index;
+        std::deque<Show> maps; // deque: addresses stay put as it grows
+        std::vector<std::unique_ptr<std::atomic<uint64_t>[]>> slabs;
+        size_t used = 0; // shows handed out of the newest slab
+    };
+
+    int rows, cols;
+    size_t wordsPerShow, slabShows;
+    std::vector<std::unique_ptr<Shard>> shards;
+    ChangeHook hook;
+    SeatStore *store = nullptr;
+
+    Shard &shardOf(const ShowKey &k) { return *shards[ShowKeyHash()(k) % shards.size()]; }
+
+    void addSlab(Shard &s)
+    {
+        s.slabs.emplace_back(new std::atomic<uint64_t>[slabShows * wordsPerShow]);
+        s.used = 0;
+    }
+};
@@ -0,0 +1,85 @@
+// snapshot.h
+#pragma once
+// checkpoint file of the admin server: "CSNP", u32 format, u64 first log
+// segment to replay on top, u32 body length, body, u32 crc32 of the body.
+// Written to <path>.tmp, synced and renamed over <path>, so a crash leaves
+// the old snapshot or the new one, never half of one
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "wal.h"
+
+const uint32_t snapshotFormat = 4; // 1: catalog as fixed Movie[], 2: no schedule, 3: no next title id
+
+inline bool writeSnapshot(const std::string &path, uint64_t segment, const std::string &body)
+{
+    std::string file("CSNP", 4);
+    uint32_t len = body.size(), crc = crc32(body.data(), body.size());
+    file.append((const char *)&snapshotFormat, 4);
+    file.append((const char *)&segment, 8);
+    file.append((const char *)&len, 4);
+    file += body;
+    file.append((const char *)&crc, 4);
+
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        perror("snapshot open");
+        return false;
+    }
+    size_t off = 0;
+    while (off < file.size())
+    {
+        ssize_t w = write(fd, file.data() + off, file.size() - off);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w <= 0)
+        {
+            perror("snapshot write");
+            close(fd);
+            return false;
+        }
+        off += w;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1)
+    {
+        perror("snapshot save");
+        return false;
+    }
+    syncDirOf(path);
+    return true;
+}
+
+// false if there is no snapshot or it does not check out; 'format' is the
+// format it was written in, older ones are still read
+inline bool readSnapshot(const std::string &path, uint64_t &segment, std::string &body, uint32_t *format = nullptr)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    std::string file;
+    char chunk[65536];
+    ssize_t r;
+    while ((r = read(fd, chunk, sizeof(chunk))) > 0)
+        file.append(chunk, r);
+    close(fd);
+    uint32_t version, len, crc;
+    if (file.size() < 24 || file.compare(0, 4, "CSNP") != 0)
+        return false;
+    memcpy(&version, file.data() + 4, 4);
+    memcpy(&segment, file.data() + 8, 8);
+    memcpy(&len, file.data() + 16, 4);
+    if (version < 1 || version > snapshotFormat || len != file.size() - 24)
+        return false;
+    memcpy(&crc, file.data() + 20 + len, 4);
+    body = file.substr(20, len);
+    if (format != nullptr)
+        *format = version;
+    return crc32(body.data(), body.size()) == crc;
+}
@@ -0,0 +1,66 @@
+// timerwheel.h
+#pragma once
+// hashed timing wheel: 'slots' buckets of one tick each. A timer further away
+// than one turn carries the number of full turns it still has to wait, so
+// scheduling is O(1) and a tick only looks at the one bucket that is due
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class TimerWheel
+{
+public:
+    explicit TimerWheel(size_t slots = 512) : buckets(slots) {}
+
+    // fires 'id' after at least 'ticks' ticks (0 = on the next tick)
+    void schedule(uint64_t id, uint64_t ticks)
+    {
+        if (ticks == 0)
+            ticks = 1;
+        std::lock_guard<std::mutex> lk(m);
+        size_t slot = (cur + ticks) % buckets.size();
+        buckets[slot].push_back({id, (ticks - 1) / buckets.size()});
+        count++;
+    }
+
+    // advances one tick and returns the ids that are due; cancelled timers are
+    // not removed from the wheel, the caller just ignores ids it no longer knows
+    std::vector<uint64_t> tick()
+    {
+        std::vector<uint64_t> due;
+        std::lock_guard<std::mutex> lk(m);
+        cur = (cur + 1) % buckets.size();
+        std::vector<Entry> &b = buckets[cur];
+        size_t keep = 0;
+        for (Entry &e : b)
+        {
+            if (e.rounds == 0)
+                due.push_back(e.id);
+            else
+            {
+                e.rounds--;
+                b[keep++] = e;
+            }
+        }
+        b.resize(keep);
+        count -= due.size();
+        return due;
+    }
+
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return count;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t id;
+        uint64_t rounds; // full turns left before it fires
+    };
+    std::mutex m;
+    std::vector<std::vector<Entry>> buckets;
+    size_t cur = 0;
+    size_t count = 0;
+};
@@ -0,0 +1,225 @@
+// titleindex.h
+#pragma once
+// search index over one catalog version, built when the version is published
+// and never changed after. Names are indexed by trigram (any substring of
+// three or more letters) and kept sorted for shorter prefixes; language and
+// minimum rating are bitmaps with one bit per title, so a filter is a few
+// word ANDs. Results come best rated first
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TitleIndex
+{
+public:
+    static constexpr int maxRating = 10;
+
+    // 'names', 'langs' and 'ratings' describe title i at position i
+    TitleIndex(const std::vector<std::string> &names, const std::vector<std::string> &langs,
+               const std::vector<int32_t> &ratings)
+        : n(names.size()), words((n + 63) / 64), rated(ratings)
+    {
+        for (const std::string &s : names)
+            lowered.push_back(lower(s));
+        for (uint32_t i = 0; i < n; i++)
+        {
+            std::vector<uint32_t> grams = trigrams(lowered[i]);
+            std::sort(grams.begin(), grams.end());
+            grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+            for (uint32_t g : grams)
+                postings[g].list.push_back(i); // positions ascend, lists stay sorted
+            Bitmap &b = byLang[lower(langs[i])];
+            b.resize(words);
+            set(b, i);
+        }
+        for (auto &it : postings)
+        {
+            Posting &p = it.second;
+            if (p.list.size() <= n / 32)
+                continue;
+            p.bits.resize(words);
+            for (uint32_t i : p.list)
+                set(p.bits, i);
+            p.list = std::vector<uint32_t>();
+        }
+        atLeast.assign(maxRating + 1, Bitmap(words));
+        for (uint32_t i = 0; i < n; i++)
+            for (int r = 0; r <= std::min(std::max(ratings[i], 0), maxRating); r++)
+                set(atLeast[r], i);
+
+        byName.resize(n);
+        rank.resize(n);
+        for (uint32_t i = 0; i < n; i++)
+            byName[i] = rank[i] = i;
+        std::sort(byName.begin(), byName.end(), [&](uint32_t a, uint32_t b) { return lowered[a] < lowered[b]; });
+        std::sort(rank.begin(), rank.end(), [&](uint32_t a, uint32_t b) {
+            return ratings[a] != ratings[b] ? ratings[a] > ratings[b] : lowered[a] < lowered[b];
+        });
+        rankOf.resize(n);
+        for (uint32_t i = 0; i < n; i++)
+            rankOf[rank[i]] = i;
+    }
+
+    // positions of at most k titles whose name contains 'name' (a prefix if
+    // it is shorter than 3 letters), in language 'lang' and rated at least
+    // minRating; empty name or lang match anything. Case is ignored
+    std::vector<uint32_t> search(const std::string &name, const std::string &lang, int32_t minRating, size_t k) const
+    {
+        std::vector<uint32_t> out;
+        Bitmap filter = atLeast[std::min(std::max(minRating, 0), maxRating)];
+        if (minRating > maxRating) // off the buckets' scale, look at the ratings themselves
+            for (uint32_t i = 0; i < n; i++)
+                if (test(filter, i) && rated[i] < minRating)
+                    filter[i / 64] &= ~(1ull << (i % 64));
+        if (!lang.empty())
+        {
+            auto it = byLang.find(lower(lang));
+            if (it == byLang.end())
+                return out;
+            for (size_t w = 0; w < words; w++)
+                filter[w] &= it->second[w];
+        }
+        if (k == 0)
+            return out;
+        if (name.empty())
+            return best(filter, k, "");
+        std::string q = lower(name);
+        if (q.size() < 3)
+        {
+            auto from = std::lower_bound(byName.begin(), byName.end(), q,
+                                         [&](uint32_t i, const std::string &q) { return lowered[i] < q; });
+            auto to = std::partition_point(from, byName.end(),
+                                           [&](uint32_t i) { return lowered[i].compare(0, q.size(), q) == 0; });
+            if ((size_t)(to - from) > n / 16)
+                return best(filter, k, q, true); // a broad prefix, the best ranked soon have it
+            for (; from != to; ++from)
+                if (test(filter, *from))
+                    out.push_back(*from);
+            return top(out, k);
+        }
+
+        std::vector<const std::vector<uint32_t> *> lists;
+        std::vector<const Bitmap *> dense;
+        for (uint32_t g : trigrams(q))
+        {
+            auto it = postings.find(g);
+            if (it == postings.end())
+                return out;
+            if (it->second.bits.empty())
+                lists.push_back(&it->second.list);
+            else
+                dense.push_back(&it->second.bits);
+        }
+        // three letters are one trigram, longer names still have to be
+        // looked for in the titles that have all of theirs
+        std::string check = q.size() > 3 ? q : "";
+        if (lists.empty())
+        {
+            for (const Bitmap *b : dense)
+                for (size_t w = 0; w < words; w++)
+                    filter[w] &= (*b)[w];
+            return best(filter, k, check);
+        }
+        for (uint32_t i : intersect(lists))
+            if (test(filter, i) &&
+                std::all_of(dense.begin(), dense.end(), [&](const Bitmap *b) { return test(*b, i); }) &&
+                contains(i, check))
+                out.push_back(i);
+        return top(out, k);
+    }
+
+private:
+    using Bitmap = std::vector<uint64_t>;
+
+    const uint32_t n;
+    const size_t words; // per bitmap
+    const std::vector<int32_t> rated;
+    std::vector<std::string> lowered;
+    // positions with a trigram; a trigram in more than 1 of 32 titles is
+    // kept as a bitmap instead, which is no bigger and tests in one step
+    struct Posting
+    {
+        std::vector<uint32_t> list;
+        Bitmap bits;
+    };
+    std::unordered_map<uint32_t, Posting> postings;
+    std::unordered_map<std::string, Bitmap> byLang;
+    std::vector<Bitmap> atLeast; // [r]: rated r or better
+    std::vector<uint32_t> byName; // positions by name
+    std::vector<uint32_t> rank, rankOf; // positions best first, and back
+
+    static std::string lower(std::string s)
+    {
+        for (char &c : s)
+            c = std::tolower((unsigned char)c);
+        return s;
+    }
+    static std::vector<uint32_t> trigrams(const std::string &s)
+    {
+        std::vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= s.size(); i++)
+            grams.push_back((uint8_t)s[i] | (uint8_t)s[i + 1] << 8 | (uint32_t)(uint8_t)s[i + 2] << 16);
+        return grams;
+    }
+    static void set(Bitmap &b, uint32_t i) { b[i / 64] |= 1ull << (i % 64); }
+    static bool test(const Bitmap &b, uint32_t i) { return b[i / 64] >> (i % 64) & 1; }
+
+    bool contains(uint32_t i, const std::string &q) const { return q.empty() || lowered[i].find(q) != std::string::npos; }
+
+    // the first k of 'hits' whose name contains q (begins with it), in rank
+    // order; best rated first, so the walk stops as soon as it has them
+    std::vector<uint32_t> best(const Bitmap &hits, size_t k, const std::string &q, bool prefix = false) const
+    {
+        std::vector<uint32_t> out;
+        for (uint32_t i = 0; i < n && out.size() < k; i++)
+        {
+            uint32_t p = rank[i];
+            if (test(hits, p) && (prefix ? lowered[p].compare(0, q.size(), q) == 0 : contains(p, q)))
+                out.push_back(p);
+        }
+        return out;
+    }
+
+    // the k best ranked of 'found'
+    std::vector<uint32_t> top(std::vector<uint32_t> &found, size_t k) const
+    {
+        auto better = [&](uint32_t a, uint32_t b) { return rankOf[a] < rankOf[b]; };
+        if (found.size() > k)
+        {
+            std::partial_sort(found.begin(), found.begin() + k, found.end(), better);
+            found.resize(k);
+        }
+        else
+            std::sort(found.begin(), found.end(), better);
+        return found;
+    }
+
+    // positions in all of the sorted lists; shortest first, galloping
+    // through the longer ones from where the last survivor was found
+    static std::vector<uint32_t> intersect(std::vector<const std::vector<uint32_t> *> &lists)
+    {
+        std::sort(lists.begin(), lists.end(), [](auto a, auto b) { return a->size() < b->size(); });
+        std::vector<uint32_t> found = *lists[0];
+        for (size_t l = 1; l < lists.size() && !found.empty(); l++)
+        {
+            size_t kept = 0;
+            auto from = lists[l]->begin(), end = lists[l]->end();
+            for (uint32_t i : found)
+            {
+                size_t step = 1;
+                while (step < (size_t)(end - from) && from[step] < i)
+                    step *= 2;
+                from = std::lower_bound(from + step / 2, step < (size_t)(end - from) ? from + step + 1 : end, i);
+                if (from == end)
+                    break;
+                if (*from == i)
+                    found[kept++] = i;
+            }
+            found.resize(kept);
+        }
+        return found;
+    }
+};
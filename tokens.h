@@ -0,0 +1,97 @@
+// tokens.h
+#pragma once
+// replies to requests that carried an idempotency token (FLAG_TOKEN), so a
+// client that retries after a timeout gets the first answer again instead of
+// being charged twice.
+// Tokens hash to stripes; each stripe keeps a few partitions, the newest
+// taking new tokens. A partition is retired whole once it is older than the
+// window (or full), so forgetting old tokens costs nothing per token and the
+// memory stays bounded
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TokenCache
+{
+public:
+    // remembers a token for at least windowSecs, unless more than about
+    // 'capacity' tokens arrive within the window
+    explicit TokenCache(size_t capacity = 1 << 16, unsigned windowSecs = 300, size_t nstripes = 32, size_t nparts = 4)
+        : perPart(capacity / nstripes / nparts + 1), slice(windowSecs / (nparts - 1) + 1), nparts(nparts)
+    {
+        for (size_t i = 0; i < nstripes; i++)
+            stripes.emplace_back(new Stripe);
+    }
+
+    // run() executes the request and returns its encoded reply; a request
+    // with a token seen before gets that reply (and lsn, the log record it
+    // waits for) without run() being called. Requests with the same token
+    // wait for each other, so a retry that overtakes the original still
+    // sees exactly one execution
+    template <typename F>
+    std::string once(uint64_t token, uint64_t &lsn, F run)
+    {
+        Stripe &s = *stripes[(token ^ (token >> 29)) % stripes.size()];
+        std::lock_guard<std::mutex> lk(s.m);
+        for (auto p = s.parts.rbegin(); p != s.parts.rend(); ++p)
+        {
+            auto it = p->entries.find(token);
+            if (it != p->entries.end())
+            {
+                repeats++;
+                lsn = it->second.lsn;
+                return it->second.reply;
+            }
+        }
+        Entry e;
+        e.reply = run(e.lsn);
+        lsn = e.lsn;
+        current(s).entries.emplace(token, e);
+        return e.reply;
+    }
+
+    uint64_t repeatCount() const { return repeats; }
+
+private:
+    struct Entry
+    {
+        std::string reply;
+        uint64_t lsn = 0;
+    };
+    struct Partition
+    {
+        time_t start;
+        std::unordered_map<uint64_t, Entry> entries;
+    };
+    struct Stripe
+    {
+        std::mutex m;
+        std::deque<Partition> parts; // oldest first
+    };
+
+    const size_t perPart;
+    const time_t slice; // seconds a partition takes new tokens
+    const size_t nparts;
+    std::vector<std::unique_ptr<Stripe>> stripes;
+    std::atomic<uint64_t> repeats{0};
+
+    // the partition taking new tokens; starts a fresh one when the newest is
+    // too old or full and drops the oldest beyond nparts
+    Partition &current(Stripe &s)
+    {
+        time_t now = time(nullptr);
+        if (s.parts.empty() || now - s.parts.back().start >= slice || s.parts.back().entries.size() >= perPart)
+        {
+            s.parts.push_back(Partition{now, {}});
+            if (s.parts.size() > nparts)
+                s.parts.pop_front();
+        }
+        return s.parts.back();
+    }
+};
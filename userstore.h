@@ -0,0 +1,372 @@
+// userstore.h
+#pragma once
+// registered users of the booking system, kept by the 12346 listener.
+// users.bin holds fixed size records, appended in signup order and mapped into
+// memory; users.bin.idx is an open-addressing hash index over them (8 byte
+// entries: the upper half of the name's hash and the record number, so a
+// probe only touches the record it is almost certainly looking for). Both
+// files double when they fill up, there is no user limit. The index can
+// always be rebuilt from the records, so it is only trusted as far as the
+// record count it was written for. Every signup is synced (record, then index
+// entry) before it is acknowledged. Passwords are only kept as scrypt hashes
+// (kdf.h); computing them is up to the caller, the store never hashes on the
+// thread that serves it (except once to upgrade a format 1 file).
+// One process opens the store for writing
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "kdf.h"
+
+const int accountNameLen = 50; // same as UserData in client.cpp and admin.cpp
+
+// 12346 wire format: the client sends one AccountRequest, the listener
+// answers with one AccountReply and closes the connection
+enum AccountOp : char
+{
+    ACCOUNT_SIGNUP = 'S',
+    ACCOUNT_LOGIN = 'L',
+};
+
+struct AccountRequest
+{
+    char op; // AccountOp
+    char username[accountNameLen];
+    char password[accountNameLen];
+};
+
+enum AccountStatus : int32_t
+{
+    ACCOUNT_OK = 0,
+    ACCOUNT_EXISTS = 1,  // signup of a name that is taken
+    ACCOUNT_INVALID = 2, // unknown user or wrong password
+    ACCOUNT_FAILED = 3,  // the store could not save it
+    ACCOUNT_BUSY = 4,    // too many logins waiting, try again
+};
+
+// AccountReply::message for each AccountStatus
+const char *const accountText[] = {"Welcome!", "This username already exists. Try a different one.",
+                                   "Invalid credentials.UserId or Passward is incorrect.",
+                                   "Could not save the account, try again later.",
+                                   "Server is busy, try again in a moment."};
+
+struct AccountReply
+{
+    int32_t status; // AccountStatus
+    char message[60];
+};
+
+struct UserRecord
+{
+    char username[accountNameLen];
+    char pad0[2];
+    PasswordHash secret;
+    uint32_t flags;
+    uint32_t reserved;
+    int64_t created; // unix time
+    char pad[8];
+};
+static_assert(sizeof(UserRecord) == 128, "two user records per cache line pair");
+
+struct UserFileHeader
+{
+    char magic[4]; // "USRS"
+    uint32_t format;
+    uint32_t recordBytes;
+    uint32_t upgraded; // format 1 records already rewritten (while upgrading)
+    uint64_t count;    // records in use
+    uint64_t capacity; // records the file has room for
+    char rest[32];
+};
+static_assert(sizeof(UserFileHeader) == 64, "user file header is one cache line");
+
+struct UserIndexHeader
+{
+    char magic[4]; // "UIDX"
+    uint32_t format;
+    uint64_t slots; // power of two
+    uint64_t count; // records 0..count-1 are in the index
+    char rest[40];
+};
+static_assert(sizeof(UserIndexHeader) == 64, "user index header is one cache line");
+
+class UserStore
+{
+public:
+    static const uint32_t format = 2; // 1 kept plain passwords
+
+    UserStore() = default;
+    UserStore(const UserStore &) = delete;
+    UserStore &operator=(const UserStore &) = delete;
+    ~UserStore()
+    {
+        unmap(data, dataLen);
+        unmap(index, indexLen);
+        if (dataFd != -1)
+            close(dataFd);
+        if (indexFd != -1)
+            close(indexFd);
+    }
+
+    // opens (or creates) path and path.idx; indexes whatever records the
+    // index file does not cover yet, rebuilding it if it is missing or broken
+    bool open(const std::string &path)
+    {
+        dataFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        indexFd = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (dataFd == -1 || indexFd == -1)
+        {
+            perror("user store");
+            return false;
+        }
+        struct stat st;
+        if (fstat(dataFd, &st) == -1)
+            return false;
+        if ((size_t)st.st_size < sizeof(UserFileHeader))
+        {
+            if (!mapData(sizeof(UserFileHeader) + 1024 * sizeof(UserRecord)))
+                return false;
+            UserFileHeader *h = dataHeader();
+            h->format = format;
+            h->recordBytes = sizeof(UserRecord);
+            h->count = 0;
+            h->capacity = 1024;
+            memcpy(h->magic, "USRS", 4);
+        }
+        else if (!mapData(st.st_size))
+            return false;
+        UserFileHeader *h = dataHeader();
+        if (memcmp(h->magic, "USRS", 4) == 0 && h->format == 1 && h->recordBytes == sizeof(UserRecord) &&
+            h->count <= h->capacity && sizeof(UserFileHeader) + h->capacity * sizeof(UserRecord) <= dataLen)
+            upgrade();
+        if (memcmp(h->magic, "USRS", 4) != 0 || h->format != format || h->recordBytes != sizeof(UserRecord) ||
+            sizeof(UserFileHeader) + h->capacity * sizeof(UserRecord) > dataLen || h->count > h->capacity)
+        {
+            fprintf(stderr, "user store: %s is not a user file\n", path.c_str());
+            return false;
+        }
+
+        if (fstat(indexFd, &st) == -1)
+            return false;
+        bool fresh = (size_t)st.st_size < sizeof(UserIndexHeader) || !mapIndex(st.st_size) ||
+                     memcmp(indexHeader()->magic, "UIDX", 4) != 0 || indexHeader()->format != format ||
+                     (indexHeader()->slots & (indexHeader()->slots - 1)) != 0 ||
+                     sizeof(UserIndexHeader) + indexHeader()->slots * 8 != indexLen ||
+                     indexHeader()->count > h->count;
+        if (fresh)
+            return rebuild(slotsFor(h->count));
+        // records a crash left out of the index
+        if (indexHeader()->count < h->count)
+        {
+            if (h->count * 2 > indexHeader()->slots)
+                return rebuild(slotsFor(h->count));
+            for (uint64_t i = indexHeader()->count; i < h->count; i++)
+                insert(i);
+            syncRange(index, indexLen, 0, indexLen);
+            indexHeader()->count = h->count;
+            syncRange(index, indexLen, 0, sizeof(UserIndexHeader));
+        }
+        return true;
+    }
+
+    bool exists(const char *username) const { return find(username) != nullptr; }
+
+    // the user's record, nullptr if there is none
+    const UserRecord *find(const char *username) const
+    {
+        uint64_t h = hash(username);
+        uint64_t mask = indexHeader()->slots - 1;
+        for (uint64_t at = h & mask;; at = (at + 1) & mask)
+        {
+            uint64_t e = slots()[at];
+            if (e == 0)
+                return nullptr;
+            if ((e >> 32) == (h >> 32))
+            {
+                const UserRecord *r = record((uint32_t)e - 1);
+                if (strncmp(r->username, username, accountNameLen) == 0)
+                    return r;
+            }
+        }
+    }
+
+    // adds a user with the hash of their password; ACCOUNT_EXISTS if the
+    // name is taken. The record is on disk before this returns
+    AccountStatus add(const char *username, const PasswordHash &secret)
+    {
+        if (username[0] == '\0' || exists(username))
+            return username[0] == '\0' ? ACCOUNT_INVALID : ACCOUNT_EXISTS;
+        UserFileHeader *h = dataHeader();
+        if (h->count == h->capacity && !growData())
+            return ACCOUNT_FAILED;
+        h = dataHeader();
+        UserRecord *r = record(h->count);
+        memset(r, 0, sizeof(*r));
+        memcpy(r->username, username, strnlen(username, accountNameLen - 1));
+        r->secret = secret;
+        r->created = time(nullptr);
+        syncRange(data, dataLen, (char *)r - (char *)data, sizeof(*r));
+        h->count++; // only counts once the record is on disk
+        syncRange(data, dataLen, 0, sizeof(UserFileHeader));
+        if ((indexHeader()->count + 1) * 2 > indexHeader()->slots)
+            return rebuild(indexHeader()->slots * 2) ? ACCOUNT_OK : ACCOUNT_FAILED;
+        uint64_t at = insert(h->count - 1);
+        syncRange(index, indexLen, sizeof(UserIndexHeader) + at * 8, 8);
+        indexHeader()->count = h->count;
+        syncRange(index, indexLen, 0, sizeof(UserIndexHeader));
+        return ACCOUNT_OK;
+    }
+
+    // the stored hash to check a login against; false for unknown users
+    bool secret(const char *username, PasswordHash &out) const
+    {
+        const UserRecord *r = find(username);
+        if (r == nullptr)
+            return false;
+        out = r->secret;
+        return true;
+    }
+
+    uint64_t size() const { return dataHeader()->count; }
+
+private:
+    int dataFd = -1, indexFd = -1;
+    void *data = nullptr, *index = nullptr;
+    size_t dataLen = 0, indexLen = 0;
+
+    UserFileHeader *dataHeader() const { return static_cast<UserFileHeader *>(data); }
+    UserIndexHeader *indexHeader() const { return static_cast<UserIndexHeader *>(index); }
+    UserRecord *record(uint64_t i) const
+    {
+        return reinterpret_cast<UserRecord *>(static_cast<char *>(data) + sizeof(UserFileHeader)) + i;
+    }
+    uint64_t *slots() const { return reinterpret_cast<uint64_t *>(static_cast<char *>(index) + sizeof(UserIndexHeader)); }
+
+    static uint64_t hash(const char *name)
+    {
+        uint64_t h = 0xCBF29CE484222325ULL;
+        for (int i = 0; i < accountNameLen && name[i] != '\0'; i++)
+            h = (h ^ (uint8_t)name[i]) * 0x100000001B3ULL;
+        return h ^ (h >> 31);
+    }
+
+    // at most half full
+    static uint64_t slotsFor(uint64_t records)
+    {
+        uint64_t n = 2048;
+        while (n < records * 2 + 2)
+            n *= 2;
+        return n;
+    }
+
+    static void unmap(void *p, size_t len)
+    {
+        if (p != nullptr)
+            munmap(p, len);
+    }
+
+    static void syncRange(void *base, size_t len, size_t off, size_t n)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t from = off / page * page;
+        if (msync(static_cast<char *>(base) + from, std::min(len - from, off + n - from), MS_SYNC) == -1)
+            perror("user store msync");
+    }
+
+    bool mapFile(int fd, size_t len, void *&p, size_t &plen)
+    {
+        if (ftruncate(fd, len) == -1)
+        {
+            perror("user store resize");
+            return false;
+        }
+        void *m = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED)
+        {
+            perror("user store mmap");
+            return false;
+        }
+        unmap(p, plen);
+        p = m;
+        plen = len;
+        return true;
+    }
+    bool mapData(size_t len) { return mapFile(dataFd, len, data, dataLen); }
+    bool mapIndex(size_t len) { return mapFile(indexFd, len, index, indexLen); }
+
+    // format 1 records had the plain password right after the name and the
+    // creation time in the last 8 bytes: hash the passwords in place (with the
+    // default cost). 'upgraded' counts the records done, so a crash halfway
+    // resumes instead of hashing a hash
+    void upgrade()
+    {
+        UserFileHeader *h = dataHeader();
+        std::vector<uint32_t> scratch;
+        for (uint64_t i = h->upgraded; i < h->count; i++)
+        {
+            UserRecord *r = record(i);
+            char *raw = reinterpret_cast<char *>(r);
+            char plain[accountNameLen + 1] = {0};
+            int64_t created;
+            memcpy(plain, raw + accountNameLen, accountNameLen);
+            memcpy(&created, raw + sizeof(UserRecord) - 8, 8);
+            memset(raw + accountNameLen, 0, sizeof(UserRecord) - accountNameLen);
+            r->secret = hashPassword(plain, 14, 8, 1, scratch);
+            r->created = created;
+            memset(plain, 0, sizeof(plain));
+            syncRange(data, dataLen, raw - static_cast<char *>(data), sizeof(UserRecord));
+            h->upgraded = i + 1;
+            syncRange(data, dataLen, 0, sizeof(UserFileHeader));
+        }
+        h->format = format;
+        h->upgraded = 0;
+        syncRange(data, dataLen, 0, sizeof(UserFileHeader));
+    }
+
+    bool growData()
+    {
+        uint64_t capacity = dataHeader()->capacity * 2;
+        if (!mapData(sizeof(UserFileHeader) + capacity * sizeof(UserRecord)))
+            return false;
+        dataHeader()->capacity = capacity;
+        return true;
+    }
+
+    // returns the slot it took
+    uint64_t insert(uint64_t i)
+    {
+        uint64_t h = hash(record(i)->username);
+        uint64_t mask = indexHeader()->slots - 1;
+        uint64_t at = h & mask;
+        while (slots()[at] != 0)
+            at = (at + 1) & mask;
+        slots()[at] = (h >> 32) << 32 | (i + 1);
+        return at;
+    }
+
+    // a new index of 'n' slots over every record
+    bool rebuild(uint64_t n)
+    {
+        size_t len = sizeof(UserIndexHeader) + n * 8;
+        if (ftruncate(indexFd, 0) == -1 || !mapIndex(len))
+            return false;
+        UserIndexHeader *ih = indexHeader();
+        ih->format = format;
+        ih->slots = n;
+        uint64_t count = dataHeader()->count;
+        for (uint64_t i = 0; i < count; i++)
+            insert(i);
+        ih->count = count;
+        syncRange(index, indexLen, 0, len);
+        memcpy(ih->magic, "UIDX", 4); // last: a half built index is never taken for a good one
+        syncRange(index, indexLen, 0, sizeof(UserIndexHeader));
+        return true;
+    }
+};
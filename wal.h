@@ -0,0 +1,341 @@
+// wal.h
+#pragma once
+// append-only write-ahead log of the admin server's state changes, kept in
+// numbered segments <prefix>.1, <prefix>.2 ... so a checkpoint can start a new
+// segment and delete the ones it covers.
+// record = u32 body length, u32 crc32 of the body, body. Appends only copy the
+// record into a buffer; one flusher thread writes whatever piled up during the
+// commit window with a single fdatasync, so concurrent bookings share a sync.
+// Replies are held back (whenDurable) until their records are on disk
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+inline uint32_t crc32(const char *p, size_t n)
+{
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; i++)
+        c = table[(c ^ (uint8_t)p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// makes a created, renamed or deleted file in path's directory durable
+inline void syncDirOf(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+class Wal
+{
+public:
+    Wal() = default;
+    Wal(const Wal &) = delete;
+    Wal &operator=(const Wal &) = delete;
+
+    // finds the segments of 'prefix'; replay() them before the first append
+    bool open(const std::string &prefix)
+    {
+        this->prefix = prefix;
+        size_t slash = prefix.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : prefix.substr(0, slash + 1);
+        std::string base = (slash == std::string::npos ? prefix : prefix.substr(slash + 1)) + ".";
+        DIR *d = opendir(dir.c_str());
+        if (d == nullptr)
+        {
+            perror("wal open");
+            return false;
+        }
+        while (dirent *e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name.compare(0, base.size(), base) != 0 || name.size() == base.size() ||
+                name.find_first_not_of("0123456789", base.size()) != std::string::npos)
+                continue;
+            segments.push_back(strtoull(name.c_str() + base.size(), nullptr, 10));
+        }
+        closedir(d);
+        std::sort(segments.begin(), segments.end());
+        return true;
+    }
+
+    // hands every intact record body of segment 'from' onwards to apply() in
+    // log order and returns how many there were; older segments are covered by
+    // the caller's snapshot and get deleted. A torn or corrupt tail (crash in
+    // the middle of a write) is cut off so new records follow the last good one
+    template <typename F>
+    size_t replay(uint64_t from, F apply)
+    {
+        size_t n = 0;
+        dropBefore(from);
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            std::string data;
+            if (!readAll(nameOf(segments[i]), data))
+                continue;
+            size_t pos = 0;
+            while (data.size() - pos >= 8)
+            {
+                uint32_t len, crc;
+                memcpy(&len, data.data() + pos, 4);
+                memcpy(&crc, data.data() + pos + 4, 4);
+                if (len > data.size() - pos - 8 || crc32(data.data() + pos + 8, len) != crc)
+                    break;
+                apply(data.substr(pos + 8, len));
+                pos += 8 + len;
+                n++;
+            }
+            if (pos < data.size())
+            {
+                if (i + 1 < segments.size())
+                {
+                    // a later segment exists, so this one was complete once
+                    fprintf(stderr, "wal: %s is damaged, later records are skipped\n", nameOf(segments[i]).c_str());
+                    break;
+                }
+                if (truncate(nameOf(segments[i]).c_str(), pos) == -1)
+                    perror("wal truncate");
+            }
+        }
+        seg = segments.empty() ? std::max<uint64_t>(from, 1) : std::max(from, segments.back());
+        fd = openSegment(seg);
+        enabled = fd != -1;
+        return n;
+    }
+
+    // starts the flusher; a record waits at most windowUs for others to share
+    // its sync (0 = only what arrives while the previous sync runs)
+    void start(unsigned windowUs)
+    {
+        window = std::chrono::microseconds(windowUs);
+        std::thread([this]() { flushLoop(); }).detach();
+    }
+
+    // thread safe; returns the record's log sequence number
+    uint64_t append(const std::string &body)
+    {
+        if (!enabled)
+            return 0; // running without a log
+        uint32_t len = body.size(), crc = crc32(body.data(), body.size());
+        std::lock_guard<std::mutex> lk(m);
+        buf.append((const char *)&len, 4);
+        buf.append((const char *)&crc, 4);
+        buf += body;
+        lsn++;
+        if (buf.size() == 8 + body.size())
+            pending.notify_one();
+        return lsn;
+    }
+
+    // records appended from now on go to a new segment; returns its number
+    // once everything before it is synced in the old one
+    uint64_t rotate()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        if (!enabled)
+            return seg;
+        rotated.wait(lk, [this]() { return !rotating; });
+        rotating = true;
+        cut = buf.size();
+        uint64_t next = seg + 1;
+        pending.notify_one();
+        rotated.wait(lk, [&]() { return seg == next; });
+        return next;
+    }
+
+    // deletes the segments before 'first', a snapshot has everything in them
+    void dropBefore(uint64_t first)
+    {
+        std::lock_guard<std::mutex> lk(files);
+        bool dropped = false;
+        while (!segments.empty() && segments.front() < first)
+        {
+            unlink(nameOf(segments.front()).c_str());
+            segments.erase(segments.begin());
+            dropped = true;
+        }
+        if (dropped)
+            syncDirOf(prefix);
+    }
+
+    // runs f once every record up to 'upto' is on disk: right away if it
+    // already is, otherwise on the flusher thread right after the sync
+    void whenDurable(uint64_t upto, std::function<void()> f)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            if (upto > durable)
+            {
+                waiters.emplace(upto, std::move(f));
+                return;
+            }
+        }
+        f();
+    }
+
+    uint64_t appended()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return lsn;
+    }
+    uint64_t syncCount() const { return syncs; }
+    uint64_t bytes() const { return size; }
+    uint64_t segment()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return seg;
+    }
+
+private:
+    std::string prefix;
+    std::mutex files;               // guards segments
+    std::vector<uint64_t> segments; // on disk, oldest first
+    int fd = -1;                    // newest segment, only the flusher touches it once started
+    bool enabled = false;           // replay() opened a segment to append to
+    uint64_t seg = 0;
+    std::mutex m;
+    std::condition_variable pending, rotated;
+    std::string buf;        // appended, not written yet
+    uint64_t lsn = 0;       // last appended
+    uint64_t durable = 0;   // last synced
+    bool rotating = false;  // the first 'cut' bytes of buf still go to the old segment
+    size_t cut = 0;
+    std::multimap<uint64_t, std::function<void()>> waiters;
+    std::chrono::microseconds window{0};
+    std::atomic<uint64_t> syncs{0}, size{0}; // only the flusher writes these
+
+    std::string nameOf(uint64_t n) const { return prefix + "." + std::to_string(n); }
+
+    int openSegment(uint64_t n)
+    {
+        int f = ::open(nameOf(n).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (f == -1)
+        {
+            perror("wal segment");
+            return -1;
+        }
+        std::lock_guard<std::mutex> lk(files);
+        if (segments.empty() || segments.back() != n)
+        {
+            segments.push_back(n);
+            syncDirOf(prefix);
+        }
+        return f;
+    }
+
+    static bool readAll(const std::string &name, std::string &data)
+    {
+        int f = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (f == -1)
+            return false;
+        char chunk[65536];
+        ssize_t r;
+        while ((r = read(f, chunk, sizeof(chunk))) > 0)
+            data.append(chunk, r);
+        close(f);
+        return true;
+    }
+
+    void writeAll(const char *p, size_t n)
+    {
+        size_t off = 0;
+        while (off < n)
+        {
+            ssize_t w = write(fd, p + off, n - off);
+            if (w == -1 && errno == EINTR)
+                continue;
+            if (w <= 0)
+            {
+                perror("wal write");
+                return;
+            }
+            off += w;
+        }
+        size += n;
+    }
+
+    void flushLoop()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        while (true)
+        {
+            pending.wait(lk, [this]() { return !buf.empty() || rotating; });
+            if (window.count() > 0 && !rotating)
+            {
+                // let the commit window fill, everything in it shares the sync
+                lk.unlock();
+                std::this_thread::sleep_for(window);
+                lk.lock();
+            }
+            std::string batch;
+            batch.swap(buf);
+            uint64_t upto = lsn;
+            bool rotate = rotating;
+            size_t head = rotate ? cut : 0;
+            lk.unlock();
+
+            if (rotate)
+            {
+                writeAll(batch.data(), head);
+                if (fdatasync(fd) == -1)
+                    perror("wal fdatasync");
+                close(fd);
+                fd = openSegment(seg + 1);
+            }
+            writeAll(batch.data() + head, batch.size() - head);
+            if (fdatasync(fd) == -1)
+                perror("wal fdatasync");
+            syncs++;
+
+            lk.lock();
+            durable = upto;
+            if (rotate)
+            {
+                seg++;
+                rotating = false;
+                rotated.notify_all();
+            }
+            std::vector<std::function<void()>> ready;
+            auto end = waiters.upper_bound(upto);
+            for (auto it = waiters.begin(); it != end; ++it)
+                ready.push_back(std::move(it->second));
+            waiters.erase(waiters.begin(), end);
+            lk.unlock();
+            for (auto &f : ready)
+                f();
+            lk.lock();
+        }
+    }
+};
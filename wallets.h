@@ -0,0 +1,183 @@
+// wallets.h
+#pragma once
+// wallet balances of the booking server's users.
+// A user id is interned once into a small account number; the id -> number
+// table is split into stripes with a reader/writer lock each, so looking a user
+// up only shares a lock with the few users hashed to the same stripe. Balances
+// are atomics read without any lock; changing one takes the lock of the
+// account's stripe, which makes "debit only if the balance covers it" a single
+// step and lets the caller log the new balance before anybody changes it again
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class WalletLedger
+{
+public:
+    // 'opening' is what a user has the first time the ledger sees them
+    explicit WalletLedger(int32_t opening = 2000, size_t nstripes = 64) : opening(opening)
+    {
+        for (size_t i = 0; i < nstripes; i++)
+            stripes.emplace_back(new Stripe);
+        for (auto &c : chunks)
+            c.store(nullptr, std::memory_order_relaxed);
+    }
+    ~WalletLedger()
+    {
+        for (auto &c : chunks)
+            delete[] c.load(std::memory_order_relaxed);
+    }
+    WalletLedger(const WalletLedger &) = delete;
+    WalletLedger &operator=(const WalletLedger &) = delete;
+
+    int32_t openingBalance() const { return opening; }
+
+    // the user's account number, opened at the opening balance if new;
+    // false only when the ledger has no room for another account
+    bool intern(const std::string &user, uint32_t &id)
+    {
+        if (lookup(user, id))
+            return true;
+        Stripe &s = stripeOf(user);
+        std::unique_lock<std::shared_mutex> lk(s.names);
+        auto it = s.ids.find(user);
+        if (it != s.ids.end())
+        {
+            id = it->second;
+            return true;
+        }
+        Account *a = slot(id);
+        if (a == nullptr)
+            return false;
+        a->user = user;
+        a->balance.store(opening, std::memory_order_relaxed);
+        s.ids.emplace(user, id);
+        return true;
+    }
+
+    // false if the user never had an account
+    bool lookup(const std::string &user, uint32_t &id) const
+    {
+        const Stripe &s = stripeOf(user);
+        std::shared_lock<std::shared_mutex> lk(s.names);
+        auto it = s.ids.find(user);
+        if (it == s.ids.end())
+            return false;
+        id = it->second;
+        return true;
+    }
+
+    int32_t balance(uint32_t id) const { return at(id).balance.load(std::memory_order_acquire); }
+    const std::string &user(uint32_t id) const { return at(id).user; }
+
+    // takes 'amount' only if the balance covers it; 'before' is the balance
+    // it found. after(user, new balance) runs while the account is still locked
+    template <typename F>
+    bool debit(uint32_t id, int32_t amount, int32_t &before, F after)
+    {
+        Account &a = at(id);
+        std::lock_guard<std::mutex> lk(stripes[id % stripes.size()]->money);
+        before = a.balance.load(std::memory_order_relaxed);
+        if (amount < 0 || amount > before)
+            return false;
+        a.balance.store(before - amount, std::memory_order_release);
+        after(a.user, before - amount);
+        return true;
+    }
+
+    // adds 'amount' (a refund) and returns the new balance
+    template <typename F>
+    int32_t credit(uint32_t id, int32_t amount, F after)
+    {
+        Account &a = at(id);
+        std::lock_guard<std::mutex> lk(stripes[id % stripes.size()]->money);
+        int32_t now = a.balance.load(std::memory_order_relaxed) + amount;
+        a.balance.store(now, std::memory_order_release);
+        after(a.user, now);
+        return now;
+    }
+
+    // overwrites the balance (admin top-up, log replay)
+    template <typename F>
+    void set(uint32_t id, int32_t balance, F after)
+    {
+        Account &a = at(id);
+        std::lock_guard<std::mutex> lk(stripes[id % stripes.size()]->money);
+        a.balance.store(balance, std::memory_order_release);
+        after(a.user, balance);
+    }
+    void set(uint32_t id, int32_t balance)
+    {
+        set(id, balance, [](const std::string &, int32_t) {});
+    }
+
+    // f(user, balance) for every account, balances as of when each is read;
+    // each stripe's names are locked in turn
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (auto &s : stripes)
+        {
+            std::shared_lock<std::shared_mutex> lk(s->names);
+            for (auto &it : s->ids)
+                f(it.first, balance(it.second));
+        }
+    }
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+
+private:
+    static const uint32_t chunkBits = 10; // accounts per chunk = 1024
+    static const uint32_t maxChunks = 4096; // 4M accounts
+
+    struct alignas(64) Account // own cache line, busy wallets do not slow their neighbours
+    {
+        std::atomic<int32_t> balance{0};
+        std::string user; // set once when interned
+    };
+
+    struct Stripe
+    {
+        mutable std::shared_mutex names;
+        std::unordered_map<std::string, uint32_t> ids;
+        std::mutex money; // balance changes of the accounts id % stripes == this one
+    };
+
+    const int32_t opening;
+    std::vector<std::unique_ptr<Stripe>> stripes;
+    std::atomic<Account *> chunks[maxChunks];
+    std::mutex grow;
+    std::atomic<uint32_t> count{0}; // accounts handed out
+
+    Stripe &stripeOf(const std::string &user) { return *stripes[std::hash<std::string>()(user) % stripes.size()]; }
+    const Stripe &stripeOf(const std::string &user) const
+    {
+        return *stripes[std::hash<std::string>()(user) % stripes.size()];
+    }
+
+    Account &at(uint32_t id) const
+    {
+        return chunks[id >> chunkBits].load(std::memory_order_acquire)[id & ((1u << chunkBits) - 1)];
+    }
+
+    // storage for a new account; ids are handed out in order under a stripe's
+    // names lock, 'grow' serializes the stripes among each other
+    Account *slot(uint32_t &id)
+    {
+        std::lock_guard<std::mutex> lk(grow);
+        id = count.load(std::memory_order_relaxed);
+        if (id >> chunkBits >= maxChunks)
+            return nullptr;
+        std::atomic<Account *> &c = chunks[id >> chunkBits];
+        if (c.load(std::memory_order_relaxed) == nullptr)
+            c.store(new Account[1u << chunkBits], std::memory_order_release);
+        count.store(id + 1, std::memory_order_release);
+        return &c.load(std::memory_order_relaxed)[id & ((1u << chunkBits) - 1)];
+    }
+};
@@ -0,0 +1,150 @@
+// workpool.h
+#pragma once
+// fixed-size worker pool with one deque per worker and work stealing
+// owners push/pop at the back (hot in cache), idle workers steal from the front
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkPool
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkPool(unsigned n)
+    {
+        if (n == 0)
+            n = 1;
+        for (unsigned i = 0; i < n; i++)
+            workers.emplace_back(new Worker);
+        for (unsigned i = 0; i < n; i++)
+            workers[i]->t = std::thread(&WorkPool::loop, this, i);
+    }
+
+    ~WorkPool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &w : workers)
+            w->t.join();
+    }
+
+    WorkPool(const WorkPool &) = delete;
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    // from a worker the task lands on that worker's own deque, otherwise the
+    // deques are filled round robin
+    void submit(Task task)
+    {
+        size_t i = (self.pool == this) ? self.index : next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        queued.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lk(workers[i]->m);
+            workers[i]->q.push_back(std::move(task));
+        }
+        {
+            // taking the lock orders this with a worker that is about to sleep
+            std::lock_guard<std::mutex> lk(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    size_t size() const { return workers.size(); }
+    long queueDepth() const { return queued.load(std::memory_order_relaxed); }
+    long stealCount() const { return steals.load(std::memory_order_relaxed); }
+    long executedCount() const { return executed.load(std::memory_order_relaxed); }
+
+    // per worker queue depth, useful to spot imbalance
+    std::vector<size_t> depths()
+    {
+        std::vector<size_t> d;
+        for (auto &w : workers)
+        {
+            std::lock_guard<std::mutex> lk(w->m);
+            d.push_back(w->q.size());
+        }
+        return d;
+    }
+
+private:
+    struct Worker
+    {
+        std::mutex m;
+        std::deque<Task> q;
+        std::thread t;
+    };
+    struct Self
+    {
+        WorkPool *pool = nullptr;
+        size_t index = 0;
+    };
+    static thread_local Self self;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next{0};
+    std::atomic<long> queued{0};
+    std::atomic<long> steals{0};
+    std::atomic<long> executed{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    bool popOwn(size_t i, Task &task)
+    {
+        std::lock_guard<std::mutex> lk(workers[i]->m);
+        if (workers[i]->q.empty())
+            return false;
+        task = std::move(workers[i]->q.back());
+        workers[i]->q.pop_back();
+        return true;
+    }
+
+    bool steal(size_t i, Task &task)
+    {
+        for (size_t k = 1; k < workers.size(); k++)
+        {
+            Worker &victim = *workers[(i + k) % workers.size()];
+            std::lock_guard<std::mutex> lk(victim.m);
+            if (victim.q.empty())
+                continue;
+            task = std::move(victim.q.front());
+            victim.q.pop_front();
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void loop(size_t i)
+    {
+        self.pool = this;
+        self.index = i;
+        while (true)
+        {
+            Task task;
+            if (popOwn(i, task) || steal(i, task))
+            {
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                task();
+                executed.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepMutex);
+            if (stopping)
+                return;
+            if (queued.load(std::memory_order_relaxed) > 0)
+                continue;
+            wake.wait(lk);
+        }
+    }
+};
+
+inline thread_local WorkPool::Self WorkPool::self;